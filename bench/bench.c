@@ -0,0 +1,238 @@
+/*
+    Microbenchmarks of the controller hot paths, linked against the null MIDI and foot-switch back ends.
+
+    Builds controller.c into this file so its static functions (calc_midi, report_build, update_lcd)
+    are reachable. Each benchmark runs a warmup of a tenth of its iterations and is then timed as a
+    whole. MIDI queued by a benchmark is drained after every op without logging; the drain is part of
+    the measured cost. ux_draw renders an 80x24 screen to /dev/null with the frame rate cap lifted.
+
+    Heap allocations are counted when the build wraps malloc/calloc/realloc (-Wl,--wrap, see
+    CMakeLists.txt); otherwise the allocs/op column is '-'.
+
+    Output is tab separated, one benchmark per line, for diffing between commits:
+
+        # eminor3-bench <iterations>
+        # name  iterations  ns/op  allocs/op
+
+    Usage: eminor3-bench [iterations] [name prefix]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <fcntl.h>
+
+// Brings in types.h and hardware.h:
+#include "controller.c"
+
+#include "midi-queue.h"
+#include "ux.h"
+
+void debug_log(const char *fmt, ...) {
+    (void) fmt;
+}
+
+// ------------------------- Allocation counting -------------------------
+
+static unsigned long bench_allocs = 0;
+
+#ifdef BENCH_WRAP_MALLOC
+extern void *__real_malloc(size_t size);
+extern void *__real_calloc(size_t n, size_t size);
+extern void *__real_realloc(void *p, size_t size);
+
+void *__wrap_malloc(size_t size) {
+    bench_allocs++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size) {
+    bench_allocs++;
+    return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *p, size_t size) {
+    bench_allocs++;
+    return __real_realloc(p, size);
+}
+#endif
+
+// ------------------------- Benchmarks -------------------------
+
+static void bench_midi_drain(void) {
+    const u8 *data;
+    u16 len;
+
+    if (midi_queue_len() == 0) return;
+    len = midi_queue_encode(&data, 0, MIDI_QUEUE_SIZE);
+    midi_queue_flushed(len, 0);
+}
+
+// Scenes the benchmarks alternate between; chosen to differ:
+static u8 bench_sc[2] = {0, 1};
+// Programs load_program alternates between:
+static u8 bench_pr[2] = {0, 1};
+
+// Pick the first program with at least two scenes that differ so switches produce MIDI:
+static void bench_select_program(void) {
+    int p;
+
+    curr.setlist_mode = 0;
+    last.setlist_mode = 0;
+    for (p = 0; p < 128; p++) {
+        activate_program(p);
+        if ((pr.scene_count >= 2) &&
+            (memcmp(&pr.scene[0], &pr.scene[1], sizeof(pr.scene[0])) != 0)) {
+            break;
+        }
+    }
+    bench_pr[0] = (u8) (p < 128 ? p : 0);
+    bench_pr[1] = (u8) ((bench_pr[0] + 1) % 128);
+
+    curr.sc_idx = 0;
+    load_scene();
+    calc_midi();
+    bench_midi_drain();
+    last = curr;
+}
+
+static void bench_calc_midi_idle(unsigned long k) {
+    (void) k;
+    calc_midi();
+    bench_midi_drain();
+    last = curr;
+}
+
+static void bench_scene_switch(unsigned long k) {
+    curr.sc_idx = bench_sc[k & 1];
+    load_scene();
+    calc_midi();
+    bench_midi_drain();
+    last = curr;
+}
+
+static void bench_load_scene(unsigned long k) {
+    curr.sc_idx = bench_sc[k & 1];
+    load_scene();
+}
+
+static void bench_load_program(unsigned long k) {
+    curr.pr_idx = bench_pr[k & 1];
+    load_program();
+    load_scene();
+}
+
+static void bench_report_build(unsigned long k) {
+    curr.amp[0].volume = (u8) (k & 1 ? 98 : 90);
+    report_build();
+}
+
+static void bench_update_lcd(unsigned long k) {
+    (void) k;
+    update_lcd();
+}
+
+static void bench_ux_draw_idle(unsigned long k) {
+    (void) k;
+    ux_notify_redraw();
+    ux_draw();
+}
+
+static void bench_ux_draw_changed(unsigned long k) {
+    curr.amp[0].volume = (u8) (k & 1 ? 98 : 90);
+    report_build();
+    ux_draw();
+}
+
+// Leave the controller on the benchmark program and scene 1 with nothing pending:
+static void bench_reset(void) {
+    curr.pr_idx = bench_pr[0];
+    load_program();
+    curr.sc_idx = 0;
+    load_scene();
+    calc_midi();
+    bench_midi_drain();
+    last = curr;
+}
+
+struct bench {
+    const char *name;
+    void (*op)(unsigned long k);
+    // Iterations are divided by this for slow ops:
+    unsigned long div;
+};
+
+static const struct bench benches[] = {
+    {"calc_midi/idle", bench_calc_midi_idle, 1},
+    {"calc_midi/scene_switch", bench_scene_switch, 1},
+    {"load_scene", bench_load_scene, 1},
+    {"load_program", bench_load_program, 10},
+    {"report_build", bench_report_build, 1},
+    {"update_lcd", bench_update_lcd, 1},
+    {"ux_draw/idle", bench_ux_draw_idle, 10},
+    {"ux_draw/changed", bench_ux_draw_changed, 10},
+};
+
+static double bench_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec * 1e9 + (double) ts.tv_nsec;
+}
+
+static void bench_run(const struct bench *b, unsigned long iterations) {
+    unsigned long n = iterations / b->div, k, allocs;
+    double t0;
+
+    if (n == 0) n = 1;
+
+    bench_reset();
+    for (k = 0; k < n / 10; k++) {
+        b->op(k);
+    }
+
+    allocs = bench_allocs;
+    t0 = bench_now_ns();
+    for (k = 0; k < n; k++) {
+        b->op(k);
+    }
+    t0 = bench_now_ns() - t0;
+    allocs = bench_allocs - allocs;
+
+#ifdef BENCH_WRAP_MALLOC
+    printf("%s\t%lu\t%.1f\t%.3f\n", b->name, n, t0 / (double) n, (double) allocs / (double) n);
+#else
+    (void) allocs;
+    printf("%s\t%lu\t%.1f\t-\n", b->name, n, t0 / (double) n);
+#endif
+    fflush(stdout);
+}
+
+int main(int argc, char **argv) {
+    unsigned long iterations = 1000000;
+    const char *prefix = "";
+    size_t i;
+
+    if (argc > 1) {
+        iterations = strtoul(argv[1], NULL, 10);
+    }
+    if (argc > 2) {
+        prefix = argv[2];
+    }
+
+    // Draw to nowhere as fast as asked:
+    ux_init_headless(open("/dev/null", O_WRONLY), 24, 80);
+    ux_fps = 1000000000;
+
+    controller_init();
+    bench_select_program();
+
+    printf("# eminor3-bench %lu\n", iterations);
+    printf("# programs %d/%d, scenes %d/%d\n", bench_pr[0] + 1, bench_pr[1] + 1, bench_sc[0] + 1, bench_sc[1] + 1);
+    printf("# name\titerations\tns/op\tallocs/op\n");
+    for (i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+        if (strncmp(benches[i].name, prefix, strlen(prefix)) != 0) continue;
+        bench_run(&benches[i], iterations);
+    }
+
+    return 0;
+}
@@ -0,0 +1,281 @@
+/*
+    Microbenchmark: compiled per-scene MIDI tables vs. the field-by-field diff calc_midi() used before.
+
+    Builds controller.c into this file so its static functions and state are reachable. MIDI output
+    is counted instead of sent. Prints ns/op for a scene switch (load_scene + amp/FX diff) and for an
+    idle tick (amp/FX diff with nothing changed) for both paths.
+
+    Usage: eminor3-bench-calc-midi [iterations]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Brings in types.h and hardware.h:
+#include "controller.c"
+
+// MIDI bytes each path produced, to check they do the same work:
+static unsigned long bench_midi_bytes = 0;
+
+void midi_send_cmd1_impl(u8 cmd_byte, u8 data1) {
+    (void) cmd_byte;
+    (void) data1;
+    bench_midi_bytes += 2;
+}
+
+void midi_send_cmd2_impl(u8 cmd_byte, u8 data1, u8 data2) {
+    (void) cmd_byte;
+    (void) data1;
+    (void) data2;
+    bench_midi_bytes += 3;
+}
+
+void midi_send_sysex(u8 byte) {
+    (void) byte;
+    bench_midi_bytes++;
+}
+
+void midi_set_priority(u8 priority) {
+    (void) priority;
+}
+
+u16 midi_queue_len(void) {
+    return 0;
+}
+
+u16 fsw_poll(void) {
+    return 0;
+}
+
+void led_set(u16 leds) {
+    (void) leds;
+}
+
+void debug_log(const char *fmt, ...) {
+    (void) fmt;
+}
+
+// ------------------------- Legacy path (calc_midi prior to compiled scenes) -------------------------
+
+static struct {
+    u8 amp_byp, amp_xy, cab_xy, gain, gate;
+} legacy_last_amp[2];
+static struct amp legacy_last[2];
+
+static void legacy_invalidate(void) {
+    u8 a;
+
+    for (a = 0; a < 2; a++) {
+        legacy_last_amp[a].amp_xy = 0x40;
+        legacy_last_amp[a].cab_xy = 0x40;
+        legacy_last_amp[a].gain = ~curr.amp[a].gain;
+        legacy_last_amp[a].gate = 0x40;
+        legacy_last[a].fx = ~curr.amp[a].fx;
+        legacy_last[a].volume = ~curr.amp[a].volume;
+    }
+}
+
+// Per-amp compare of every field as calc_midi did it; returns 1 if anything was sent:
+static u8 legacy_calc_midi(void) {
+    u8 diff = 0;
+    u8 dirty, last_dirty;
+    u8 acoustc, last_acoustc;
+    u8 test_fx = 1;
+    u8 i, a;
+
+    for (a = 0; a < 2; a++) {
+        dirty = curr.amp[a].fx & fxm_dirty;
+        acoustc = curr.amp[a].fx & fxm_acoustc;
+        last_dirty = legacy_last[a].fx & fxm_dirty;
+        last_acoustc = legacy_last[a].fx & fxm_acoustc;
+
+        if (acoustc != 0) {
+            if (legacy_last_amp[a].amp_byp != 0x00) {
+                legacy_last_amp[a].amp_byp = 0x00;
+                midi_axe_cc(axe_cc_byp_amp1 + a, legacy_last_amp[a].amp_byp, MIDI_PRIO_HIGH);
+                diff = 1;
+            }
+            if (legacy_last_amp[a].cab_xy != 0x00) {
+                legacy_last_amp[a].cab_xy = 0x00;
+                midi_axe_cc(axe_cc_xy_cab1 + a, legacy_last_amp[a].cab_xy, MIDI_PRIO_HIGH);
+                diff = 1;
+            }
+            if (legacy_last_amp[a].gain != clean_gain[a]) {
+                legacy_last_amp[a].gain = clean_gain[a];
+                midi_axe_cc(axe_cc_external3 + a, legacy_last_amp[a].gain, MIDI_PRIO_NORMAL);
+                diff = 1;
+            }
+            if (legacy_last_amp[a].gate != 0x00) {
+                legacy_last_amp[a].gate = 0x00;
+                midi_axe_cc(axe_cc_byp_gate1 + a, legacy_last_amp[a].gate, MIDI_PRIO_NORMAL);
+                diff = 1;
+            }
+        } else if (dirty != 0) {
+            u8 gain = or_default(curr.amp[a].gain, pr.default_gain[a]);
+            if (legacy_last_amp[a].amp_byp != 0x7F) {
+                legacy_last_amp[a].amp_byp = 0x7F;
+                midi_axe_cc(axe_cc_byp_amp1 + a, legacy_last_amp[a].amp_byp, MIDI_PRIO_HIGH);
+                diff = 1;
+            }
+            if (legacy_last_amp[a].amp_xy != 0x7F) {
+                legacy_last_amp[a].amp_xy = 0x7F;
+                midi_axe_cc(axe_cc_xy_amp1 + a, legacy_last_amp[a].amp_xy, MIDI_PRIO_HIGH);
+                diff = 1;
+            }
+            if (legacy_last_amp[a].cab_xy != 0x7F) {
+                legacy_last_amp[a].cab_xy = 0x7F;
+                midi_axe_cc(axe_cc_xy_cab1 + a, legacy_last_amp[a].cab_xy, MIDI_PRIO_HIGH);
+                diff = 1;
+            }
+            if (legacy_last_amp[a].gain != gain) {
+                legacy_last_amp[a].gain = gain;
+                midi_axe_cc(axe_cc_external3 + a, legacy_last_amp[a].gain, MIDI_PRIO_NORMAL);
+                diff = 1;
+            }
+            if (legacy_last_amp[a].gate != 0x7F) {
+                legacy_last_amp[a].gate = 0x7F;
+                midi_axe_cc(axe_cc_byp_gate1 + a, legacy_last_amp[a].gate, MIDI_PRIO_NORMAL);
+                diff = 1;
+            }
+        } else {
+            if (legacy_last_amp[a].amp_byp != 0x7F) {
+                legacy_last_amp[a].amp_byp = 0x7F;
+                midi_axe_cc(axe_cc_byp_amp1 + a, legacy_last_amp[a].amp_byp, MIDI_PRIO_HIGH);
+                diff = 1;
+            }
+            if (legacy_last_amp[a].amp_xy != 0x00) {
+                legacy_last_amp[a].amp_xy = 0x00;
+                midi_axe_cc(axe_cc_xy_amp1 + a, legacy_last_amp[a].amp_xy, MIDI_PRIO_HIGH);
+                diff = 1;
+            }
+            if (legacy_last_amp[a].cab_xy != 0x7F) {
+                legacy_last_amp[a].cab_xy = 0x7F;
+                midi_axe_cc(axe_cc_xy_cab1 + a, legacy_last_amp[a].cab_xy, MIDI_PRIO_HIGH);
+                diff = 1;
+            }
+            if (legacy_last_amp[a].gain != clean_gain[a]) {
+                legacy_last_amp[a].gain = clean_gain[a];
+                midi_axe_cc(axe_cc_external3 + a, legacy_last_amp[a].gain, MIDI_PRIO_NORMAL);
+                diff = 1;
+            }
+            if (legacy_last_amp[a].gate != 0x00) {
+                legacy_last_amp[a].gate = 0x00;
+                midi_axe_cc(axe_cc_byp_gate1 + a, legacy_last_amp[a].gate, MIDI_PRIO_NORMAL);
+                diff = 1;
+            }
+        }
+
+        if ((last_acoustc | last_dirty) != (acoustc | dirty)) {
+            midi_axe_cc(axe_cc_byp_compressor1 + a, 0x7F, MIDI_PRIO_LOW);
+        }
+
+        if (curr.amp[a].volume != legacy_last[a].volume) {
+            midi_axe_cc(axe_cc_external1 + a, (curr.amp[a].volume), MIDI_PRIO_HIGH);
+            diff = 1;
+        }
+    }
+
+    for (i = 0; i < 5; i++, test_fx <<= 1) {
+        if ((curr.amp[0].fx & test_fx) != (legacy_last[0].fx & test_fx)) {
+            midi_axe_cc(pr.fx_midi_cc[0][i], calc_cc_toggle(curr.amp[0].fx & test_fx), MIDI_PRIO_NORMAL);
+            diff = 1;
+        }
+        if ((curr.amp[1].fx & test_fx) != (legacy_last[1].fx & test_fx)) {
+            midi_axe_cc(pr.fx_midi_cc[1][i], calc_cc_toggle(curr.amp[1].fx & test_fx), MIDI_PRIO_NORMAL);
+            diff = 1;
+        }
+    }
+
+    legacy_last[0] = curr.amp[0];
+    legacy_last[1] = curr.amp[1];
+
+    return diff;
+}
+
+// ------------------------- Harness -------------------------
+
+static double bench_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec * 1e9 + (double) ts.tv_nsec;
+}
+
+// Pick the first program with at least two scenes that differ so switches produce MIDI:
+static void bench_select_program(void) {
+    int p;
+
+    for (p = 0; p < 128; p++) {
+        activate_program(p);
+        if ((pr.scene_count >= 2) &&
+            (memcmp(&pr.scene[0], &pr.scene[1], sizeof(pr.scene[0])) != 0)) {
+            break;
+        }
+    }
+    curr.sc_idx = 0;
+    load_scene();
+}
+
+static void bench_report(const char *name, double ns, unsigned long iterations, unsigned long bytes) {
+    printf("%-22s %10.1f ns/op  %8.2f MIDI bytes/op\n", name, ns / (double) iterations,
+           (double) bytes / (double) iterations);
+}
+
+int main(int argc, char **argv) {
+    unsigned long iterations = 1000000;
+    unsigned long k;
+    double t0;
+
+    if (argc > 1) {
+        iterations = strtoul(argv[1], NULL, 10);
+    }
+
+    controller_init();
+    bench_select_program();
+    printf("program %d \"%.20s\", %lu iterations\n", curr.pr_idx + 1, pr.name, iterations);
+
+    // Scene switch, compiled tables:
+    midi_invalidate();
+    midi_update_amps();
+    last = curr;
+    bench_midi_bytes = 0;
+    t0 = bench_now_ns();
+    for (k = 0; k < iterations; k++) {
+        curr.sc_idx = (u8) (k & 1);
+        load_scene();
+        midi_update_amps();
+        last = curr;
+    }
+    bench_report("scene_switch/compiled", bench_now_ns() - t0, iterations, bench_midi_bytes);
+
+    // Scene switch, legacy field-by-field diff:
+    legacy_invalidate();
+    legacy_calc_midi();
+    bench_midi_bytes = 0;
+    t0 = bench_now_ns();
+    for (k = 0; k < iterations; k++) {
+        curr.sc_idx = (u8) (k & 1);
+        load_scene();
+        legacy_calc_midi();
+    }
+    bench_report("scene_switch/legacy", bench_now_ns() - t0, iterations, bench_midi_bytes);
+
+    // Idle tick with nothing changed, compiled tables:
+    bench_midi_bytes = 0;
+    t0 = bench_now_ns();
+    for (k = 0; k < iterations; k++) {
+        midi_update_amps();
+        last = curr;
+    }
+    bench_report("idle_tick/compiled", bench_now_ns() - t0, iterations, bench_midi_bytes);
+
+    // Idle tick with nothing changed, legacy:
+    bench_midi_bytes = 0;
+    t0 = bench_now_ns();
+    for (k = 0; k < iterations; k++) {
+        legacy_calc_midi();
+    }
+    bench_report("idle_tick/legacy", bench_now_ns() - t0, iterations, bench_midi_bytes);
+
+    return 0;
+}
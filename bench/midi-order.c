@@ -0,0 +1,172 @@
+/*
+    Check of the MIDI scheduler's priority ordering using the null back end's test mode (see
+    null/midi-record.h).
+
+    Builds controller.c into this file and walks the set list as eminor3-setlist-cost does: power on,
+    then each song entered with activate_song() and stepped through its scenes with next_scene(),
+    one controller_handle() and midi_flush() per transition on a virtual clock. Every flush must
+    emit its messages in priority order (program change first, then high, normal and low); the
+    first flush that does not fails the run.
+
+    The recorded order is printed as one "# from -> to  program" line per transition followed by
+    its "MIDI[prio]: bytes" lines, and can be diffed against a golden file so changes to what is
+    sent within a priority are caught too.
+
+    Usage: eminor3-midi-order [-g golden | -w golden]
+
+        -g golden   compare the recorded order against `golden`; exit 1 at the first difference
+        -w golden   write the recorded order to `golden` instead of stdout
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// Brings in types.h and hardware.h:
+#include "controller.c"
+
+#include "midi.h"
+#include "midi-wire.h"
+#include "midi-record.h"
+
+void debug_log(const char *fmt, ...) {
+    (void) fmt;
+}
+
+// Virtual clock for the wire and running status:
+static uint64_t order_now_usec = 0;
+
+static uint64_t order_clock(void) {
+    return order_now_usec;
+}
+
+static FILE *order_out = NULL;
+static int order_failed = 0;
+
+// Run the change just made to `curr` through one controller tick and check the order it was sent in:
+static void order_tick(const char *from) {
+    u8 prio, last_prio = MIDI_PRIO_PROGRAM;
+    const u8 *msg;
+    int i;
+
+    order_now_usec += 2000000;
+    midi_record_start();
+    controller_handle();
+    midi_flush();
+
+    fprintf(order_out, "# %s -> %d.%d  %.*s\n", from, curr.sl_idx + 1, curr.sc_idx + 1,
+            PROGRAM_NAME_LEN, pr_names[sl.entries[curr.sl_idx].program]);
+    midi_record_dump(order_out, 0);
+
+    for (i = 0; i < midi_record_count(); i++) {
+        midi_record_get(i, &prio, &msg);
+        if (prio < last_prio) {
+            fprintf(stderr, "midi-order: %s -> %d.%d: message %d at priority %d after priority %d\n",
+                    from, curr.sl_idx + 1, curr.sc_idx + 1, i, prio, last_prio);
+            order_failed = 1;
+        }
+        last_prio = prio;
+    }
+}
+
+// Compare `out` (len bytes) against the golden file; returns 0 if identical:
+static int order_compare(const char *golden, const char *out, size_t len) {
+    FILE *f;
+    char want[1024];
+    const char *p = out, *end = out + len;
+    int lineno = 0;
+
+    f = fopen(golden, "r");
+    if (f == NULL) {
+        perror(golden);
+        return 1;
+    }
+
+    while (fgets(want, sizeof(want), f) != NULL) {
+        const char *nl = memchr(p, '\n', end - p);
+        size_t n = nl ? (size_t) (nl - p + 1) : (size_t) (end - p);
+
+        lineno++;
+        if ((n != strlen(want)) || (memcmp(p, want, n) != 0)) {
+            fprintf(stderr, "%s:%d: MIDI order differs\n", golden, lineno);
+            fprintf(stderr, "  expected: %s", want);
+            fprintf(stderr, "  got:      %.*s", (int) n, n ? p : "(end of output)\n");
+            fclose(f);
+            return 1;
+        }
+        p += n;
+    }
+    fclose(f);
+
+    if (p != end) {
+        fprintf(stderr, "%s:%d: MIDI order has more lines than expected\n", golden, lineno + 1);
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    const char *golden = NULL, *write_fname = NULL;
+    char *capture = NULL;
+    size_t capture_len = 0;
+    char from[16];
+    int c, s, retval = 0;
+
+    while ((c = getopt(argc, argv, "g:w:")) != -1) {
+        switch (c) {
+            case 'g': golden = optarg; break;
+            case 'w': write_fname = optarg; break;
+            default:
+                fprintf(stderr, "usage: %s [-g golden | -w golden]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if (golden != NULL) {
+        order_out = open_memstream(&capture, &capture_len);
+    } else if (write_fname != NULL) {
+        order_out = fopen(write_fname, "w");
+    } else {
+        order_out = stdout;
+    }
+    if (order_out == NULL) {
+        perror(write_fname ? write_fname : "open_memstream");
+        return 3;
+    }
+
+    midi_wire_clock = order_clock;
+    midi_wire_log = false;
+    midi_record_log = false;
+
+    // Power on at song 1, scene 1:
+    controller_init();
+    order_tick("on");
+
+    for (s = 0; s < sl.count; s++) {
+        if (s > 0) {
+            snprintf(from, sizeof(from), "%d.%d", curr.sl_idx + 1, curr.sc_idx + 1);
+            activate_song(s);
+            order_tick(from);
+        }
+        while (curr.sc_idx < pr.scene_count - 1) {
+            snprintf(from, sizeof(from), "%d.%d", curr.sl_idx + 1, curr.sc_idx + 1);
+            next_scene();
+            order_tick(from);
+        }
+    }
+
+    fflush(order_out);
+    if (order_out != stdout) fclose(order_out);
+
+    if (golden != NULL) {
+        retval = order_compare(golden, capture, capture_len);
+        if (retval == 0) fprintf(stderr, "midi-order: matches %s\n", golden);
+        free(capture);
+    }
+    if (order_failed) {
+        fprintf(stderr, "midi-order: messages sent out of priority order\n");
+        retval = 1;
+    }
+
+    return retval;
+}
@@ -0,0 +1,363 @@
+/*
+    Deterministic replay of recorded foot-switch traces through controller.c.
+
+    Drives controller_handle() on a virtual clock the way the main loop does: controller_10msec_timer()
+    every 10ms and a controller_handle() on every timer tick and on every foot-switch change, with
+    fsw_poll() returning the bitmask the trace says is down at that time. Every midi_send_* call is
+    captured with the virtual time it happened at. Programs come from the compiled-in flash banks and
+    nothing touches disk unless an image file is given with -f; that image is recreated from the
+    compiled-in programs so runs do not depend on earlier edits.
+
+    Trace file, one change per line ('#' starts a comment):
+
+        <ms> <hex foot-switch bitmask>
+
+    MIDI output, one message per line (a SysEx message is collected up to its F7):
+
+        <ms> <hex bytes>
+
+    Usage: eminor3-replay [-g golden | -w golden] [-b iterations] [-t tail_ms] [-f flash] [-v] trace
+
+        -g golden   compare the MIDI output against `golden`; exit 1 at the first difference
+        -w golden   write the MIDI output to `golden` instead of stdout
+        -b N        afterwards replay the trace N more times with output off and print throughput
+        -t ms       keep ticking this long after the last trace line (default 1000)
+        -f flash    flash image to recreate for the run, with its journal, so write-backs are stored
+        -v          show debug_log output on stderr
+*/
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "types.h"
+#include "hardware.h"
+#include "flash.h"
+
+extern void controller_init(void);
+extern void controller_10msec_timer(void);
+extern void controller_handle(void);
+
+struct replay_step {
+    unsigned long ms;
+    u16 fsw;
+};
+
+static struct replay_step *replay_steps = NULL;
+static int replay_steps_n = 0;
+
+// Virtual time of the current tick and the foot-switches down at it:
+static unsigned long replay_ms = 0;
+static u16 replay_fsw = 0;
+
+static int replay_verbose = 0;
+
+// MIDI capture; NULL while benchmarking:
+static FILE *replay_out = NULL;
+static unsigned long replay_midi_bytes = 0;
+
+// SysEx bytes collected so far:
+static u8 replay_sysex[256];
+static int replay_sysex_n = 0;
+
+static void replay_emit(const u8 *msg, int count) {
+    int i;
+
+    replay_midi_bytes += count;
+    if (replay_out == NULL) return;
+
+    fprintf(replay_out, "%lu", replay_ms);
+    for (i = 0; i < count; i++) {
+        fprintf(replay_out, " %02X", msg[i]);
+    }
+    fprintf(replay_out, "\n");
+}
+
+void midi_send_cmd1_impl(u8 cmd_byte, u8 data1) {
+    u8 msg[2] = {cmd_byte, data1};
+    replay_emit(msg, 2);
+}
+
+void midi_send_cmd2_impl(u8 cmd_byte, u8 data1, u8 data2) {
+    u8 msg[3] = {cmd_byte, data1, data2};
+    replay_emit(msg, 3);
+}
+
+void midi_send_sysex(u8 byte) {
+    if ((byte == 0xF0) || (replay_sysex_n == sizeof(replay_sysex))) {
+        if (replay_sysex_n > 0) replay_emit(replay_sysex, replay_sysex_n);
+        replay_sysex_n = 0;
+    }
+
+    replay_sysex[replay_sysex_n++] = byte;
+    if (byte == 0xF7) {
+        replay_emit(replay_sysex, replay_sysex_n);
+        replay_sysex_n = 0;
+    }
+}
+
+void midi_set_priority(u8 priority) {
+    (void) priority;
+}
+
+u16 midi_queue_len(void) {
+    return 0;
+}
+
+u16 fsw_poll(void) {
+    return replay_fsw;
+}
+
+void led_set(u16 leds) {
+    (void) leds;
+}
+
+void report_notify(void) {
+}
+
+void debug_log(const char *fmt, ...) {
+    va_list ap;
+
+    if (!replay_verbose) return;
+
+    va_start(ap, fmt);
+    fprintf(stderr, "%6lu ", replay_ms);
+    vfprintf(stderr, fmt, ap);
+    fprintf(stderr, "\n");
+    va_end(ap);
+}
+
+static int replay_load(const char *fname) {
+    FILE *f;
+    char line[256];
+    int cap = 0, lineno = 0;
+
+    f = fopen(fname, "r");
+    if (f == NULL) {
+        perror(fname);
+        return 1;
+    }
+
+    while (fgets(line, sizeof(line), f) != NULL) {
+        unsigned long ms;
+        unsigned int fsw;
+        char *p;
+
+        lineno++;
+        if ((p = strchr(line, '#')) != NULL) *p = 0;
+        for (p = line; (*p == ' ') || (*p == '\t'); p++);
+        if ((*p == '\n') || (*p == '\r') || (*p == 0)) continue;
+
+        if ((sscanf(p, "%lu %x", &ms, &fsw) != 2) || (fsw > 0xFFFF)) {
+            fprintf(stderr, "%s:%d: expected '<ms> <hex bitmask>'\n", fname, lineno);
+            fclose(f);
+            return 2;
+        }
+        if ((replay_steps_n > 0) && (ms < replay_steps[replay_steps_n - 1].ms)) {
+            fprintf(stderr, "%s:%d: time goes backwards\n", fname, lineno);
+            fclose(f);
+            return 2;
+        }
+
+        if (replay_steps_n == cap) {
+            cap = cap ? cap * 2 : 64;
+            replay_steps = realloc(replay_steps, cap * sizeof(struct replay_step));
+            if (replay_steps == NULL) {
+                perror("realloc");
+                fclose(f);
+                return 3;
+            }
+        }
+        replay_steps[replay_steps_n].ms = ms;
+        replay_steps[replay_steps_n].fsw = (u16) fsw;
+        replay_steps_n++;
+    }
+
+    fclose(f);
+    return 0;
+}
+
+static long long replay_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// controller_handle calls made and the time spent in them:
+static unsigned long replay_handles = 0;
+static long long replay_handle_ns = 0;
+
+// Replay the whole trace once from a freshly initialized controller:
+static void replay_run(unsigned long tail_ms) {
+    unsigned long end_ms, next_timer_ms = 10;
+    int step = 0;
+
+    replay_ms = 0;
+    replay_fsw = 0;
+    replay_sysex_n = 0;
+    controller_init();
+
+    end_ms = (replay_steps_n ? replay_steps[replay_steps_n - 1].ms : 0) + tail_ms;
+    for (;;) {
+        unsigned long wake_ms = next_timer_ms;
+        bool timer = true;
+        long long t0;
+
+        // Wake early for a foot-switch change, as the input fd would:
+        if ((step < replay_steps_n) && (replay_steps[step].ms < wake_ms)) {
+            wake_ms = replay_steps[step].ms;
+            timer = false;
+        }
+        if (wake_ms > end_ms) break;
+
+        replay_ms = wake_ms;
+        if (timer) {
+            controller_10msec_timer();
+            next_timer_ms += 10;
+        }
+        while ((step < replay_steps_n) && (replay_steps[step].ms <= replay_ms)) {
+            replay_fsw = replay_steps[step].fsw;
+            step++;
+        }
+
+        t0 = replay_ns();
+        controller_handle();
+        replay_handle_ns += replay_ns() - t0;
+        replay_handles++;
+    }
+}
+
+// Compare `out` (len bytes) against the golden file line by line; returns 0 if identical:
+static int replay_compare(const char *golden, const char *out, size_t len) {
+    FILE *f;
+    char want[1024], got[1024];
+    const char *p = out, *end = out + len;
+    int lineno = 0;
+
+    f = fopen(golden, "r");
+    if (f == NULL) {
+        perror(golden);
+        return 1;
+    }
+
+    for (;;) {
+        bool have_want = fgets(want, sizeof(want), f) != NULL;
+        bool have_got = p < end;
+
+        lineno++;
+        if (!have_want && !have_got) break;
+
+        got[0] = 0;
+        if (have_got) {
+            const char *nl = memchr(p, '\n', end - p);
+            size_t n = nl ? (size_t) (nl - p + 1) : (size_t) (end - p);
+            if (n >= sizeof(got)) n = sizeof(got) - 1;
+            memcpy(got, p, n);
+            got[n] = 0;
+            p += n;
+        }
+        if (!have_want) want[0] = 0;
+
+        if (!have_want || !have_got || (strcmp(want, got) != 0)) {
+            fprintf(stderr, "%s:%d: MIDI output differs\n", golden, lineno);
+            fprintf(stderr, "  expected: %s", have_want ? want : "(end of file)\n");
+            fprintf(stderr, "  got:      %s", have_got ? got : "(end of output)\n");
+            fclose(f);
+            return 1;
+        }
+    }
+
+    fclose(f);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    const char *golden = NULL, *write_fname = NULL;
+    const char *flash = NULL;
+    unsigned long tail_ms = 1000;
+    long iterations = 0, i;
+    char *capture = NULL;
+    size_t capture_len = 0;
+    char fname[300];
+    int c, retval;
+
+    while ((c = getopt(argc, argv, "g:w:b:t:f:v")) != -1) {
+        switch (c) {
+            case 'g': golden = optarg; break;
+            case 'w': write_fname = optarg; break;
+            case 'b': iterations = strtol(optarg, NULL, 10); break;
+            case 't': tail_ms = strtoul(optarg, NULL, 10); break;
+            case 'f': flash = optarg; break;
+            case 'v': replay_verbose = 1; break;
+            default:
+                fprintf(stderr, "usage: %s [-g golden | -w golden] [-b iterations] [-t tail_ms] [-f flash] [-v] trace\n", argv[0]);
+                return 1;
+        }
+    }
+    if (optind != argc - 1) {
+        fprintf(stderr, "usage: %s [-g golden | -w golden] [-b iterations] [-t tail_ms] [-f flash] [-v] trace\n", argv[0]);
+        return 1;
+    }
+
+    if ((retval = replay_load(argv[optind])) != 0) {
+        return retval;
+    }
+
+    // Start from the compiled-in programs every time:
+    if (flash != NULL) {
+        flash_fname = flash;
+        unlink(flash);
+        snprintf(fname, sizeof(fname), "%s.journal", flash);
+        unlink(fname);
+        if ((retval = flash_init()) != 0) {
+            return retval;
+        }
+    }
+
+    if (golden != NULL) {
+        replay_out = open_memstream(&capture, &capture_len);
+    } else if (write_fname != NULL) {
+        replay_out = fopen(write_fname, "w");
+    } else {
+        replay_out = stdout;
+    }
+    if (replay_out == NULL) {
+        perror(write_fname ? write_fname : "open_memstream");
+        return 3;
+    }
+
+    replay_run(tail_ms);
+    fflush(replay_out);
+    if (replay_out != stdout) fclose(replay_out);
+    replay_out = NULL;
+
+    fprintf(stderr, "replay: %d trace lines, %lu ticks, %lu MIDI bytes\n", replay_steps_n, replay_handles, replay_midi_bytes);
+
+    retval = 0;
+    if (golden != NULL) {
+        retval = replay_compare(golden, capture, capture_len);
+        if (retval == 0) fprintf(stderr, "replay: matches %s\n", golden);
+        free(capture);
+    }
+
+    if (iterations > 0) {
+        long long t0;
+
+        replay_handles = 0;
+        replay_handle_ns = 0;
+        t0 = replay_ns();
+        for (i = 0; i < iterations; i++) {
+            replay_run(tail_ms);
+        }
+        t0 = replay_ns() - t0;
+
+        printf("ticks        %lu\n", replay_handles);
+        printf("ticks/sec    %.0f\n", replay_handles * 1e9 / (double) t0);
+        printf("ns/handle    %.1f\n", replay_handle_ns / (double) replay_handles);
+    }
+
+    return retval;
+}
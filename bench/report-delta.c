@@ -0,0 +1,225 @@
+/*
+    Randomized round-trip check of the report delta encoding (common/report-delta.c).
+
+    Walks a pseudo-random sequence of reports, each changing a few fields of the one before (now and
+    then every field), encodes each against the previous update and decodes it, and checks that the
+    decoder rebuilt exactly the report that was encoded. Along the way:
+
+        - every 97th update is dropped before decoding; the decoder must match again from the next
+          keyframe on
+        - every update is also decoded truncated at a random length into a copy of the decoder; a
+          truncated update must either decode or be rejected leaving the last good report intact
+
+    Prints the updates, keyframes and bytes per update on success; exits 1 at the first mismatch.
+
+    Usage: eminor3-report-delta-roundtrip [-n updates] [-s seed]
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "types.h"
+#include "hardware.h"
+#include "report-delta.h"
+
+// Dropped updates are every this many:
+#define ROUNDTRIP_DROP_EVERY 97
+
+static uint32_t roundtrip_seed = 1;
+
+// xorshift32; deterministic for a given seed on every platform:
+static uint32_t roundtrip_rand(void) {
+    uint32_t x = roundtrip_seed;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    roundtrip_seed = x;
+    return x;
+}
+
+// A value for an int field, biased towards the small values reports usually carry:
+static int roundtrip_int(void) {
+    switch (roundtrip_rand() % 4) {
+        case 0: return (int) (roundtrip_rand() % 128);
+        case 1: return (int) (roundtrip_rand() % 1000);
+        case 2: return -(int) (roundtrip_rand() % 1000);
+        default: return (int) roundtrip_rand();
+    }
+}
+
+static unsigned long roundtrip_ulong(void) {
+    unsigned long v = roundtrip_rand();
+
+    if (sizeof(v) > 4) {
+        v = (v << 16 << 16) | roundtrip_rand();
+    }
+    return v >> (roundtrip_rand() % (sizeof(v) * 8));
+}
+
+static void roundtrip_amp(struct amp_report *a, int field) {
+    int i;
+
+    switch (field) {
+        case 0: a->tone = (enum amp_tone) (roundtrip_rand() % 3); break;
+        case 1: a->gain_dirty = roundtrip_int(); break;
+        case 2: a->gain_clean = roundtrip_int(); break;
+        case 3: a->volume = roundtrip_int(); break;
+        case 4: a->fx_enabled[roundtrip_rand() % FX_COUNT] ^= true; break;
+        default:
+            for (i = 0; i < FX_COUNT; i++) {
+                a->fx_midi_cc[i] = (u8) roundtrip_rand();
+            }
+            break;
+    }
+}
+
+// Change field `field` of `r` (0 <= field < ROUNDTRIP_FIELDS):
+#define ROUNDTRIP_FIELDS 27
+
+static void roundtrip_mutate(struct report *r, int field) {
+    int i;
+
+    switch (field) {
+        case 0: r->is_setlist_mode ^= true; break;
+        case 1:
+            for (i = 0; i < REPORT_PR_NAME_LEN; i++) {
+                r->pr_name[i] = (char) (' ' + roundtrip_rand() % 95);
+            }
+            r->pr_name[roundtrip_rand() % REPORT_PR_NAME_LEN] = 0;
+            break;
+        case 2: r->tempo = (u8) roundtrip_rand(); break;
+        case 3: r->is_modified ^= true; break;
+        case 4: r->pr_val = roundtrip_int(); break;
+        case 5: r->pr_max = roundtrip_int(); break;
+        case 6: r->sl_val = roundtrip_int(); break;
+        case 7: r->sl_max = roundtrip_int(); break;
+        case 8: r->sc_val = roundtrip_int(); break;
+        case 9: r->sc_max = roundtrip_int(); break;
+        case 10: r->dirty_pages = roundtrip_int(); break;
+        case 11: r->flushes = roundtrip_ulong(); break;
+        case 12: r->flush_usec = roundtrip_ulong(); break;
+        case 13: r->flush_usec_max = roundtrip_ulong(); break;
+        case 26: r->flush_failures = roundtrip_ulong(); break;
+        default:
+            field -= 14;
+            roundtrip_amp(&r->amp[field / 6], field % 6);
+            break;
+    }
+}
+
+// Compare two reports field by field (padding is not encoded); returns the first differing field
+// name or NULL:
+static const char *roundtrip_diff(const struct report *x, const struct report *y) {
+    int a, i;
+
+#define ROUNDTRIP_CMP(f) if (x->f != y->f) return #f
+    ROUNDTRIP_CMP(is_setlist_mode);
+    if (memcmp(x->pr_name, y->pr_name, REPORT_PR_NAME_LEN) != 0) return "pr_name";
+    ROUNDTRIP_CMP(tempo);
+    ROUNDTRIP_CMP(is_modified);
+    ROUNDTRIP_CMP(pr_val);
+    ROUNDTRIP_CMP(pr_max);
+    ROUNDTRIP_CMP(sl_val);
+    ROUNDTRIP_CMP(sl_max);
+    ROUNDTRIP_CMP(sc_val);
+    ROUNDTRIP_CMP(sc_max);
+    ROUNDTRIP_CMP(dirty_pages);
+    ROUNDTRIP_CMP(flushes);
+    ROUNDTRIP_CMP(flush_usec);
+    ROUNDTRIP_CMP(flush_usec_max);
+    ROUNDTRIP_CMP(flush_failures);
+    for (a = 0; a < 2; a++) {
+        ROUNDTRIP_CMP(amp[a].tone);
+        ROUNDTRIP_CMP(amp[a].gain_dirty);
+        ROUNDTRIP_CMP(amp[a].gain_clean);
+        ROUNDTRIP_CMP(amp[a].volume);
+        for (i = 0; i < FX_COUNT; i++) {
+            ROUNDTRIP_CMP(amp[a].fx_enabled[i]);
+            ROUNDTRIP_CMP(amp[a].fx_midi_cc[i]);
+        }
+    }
+#undef ROUNDTRIP_CMP
+
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    struct report_delta_encoder enc;
+    struct report_delta_decoder dec, trunc;
+    struct report r;
+    u8 buf[REPORT_DELTA_MAX];
+    unsigned long n = 100000, i, updates = 0, keyframes = 0, dropped = 0, bytes = 0;
+    bool synced = true;
+    const char *field;
+    int c, len, k, changes;
+
+    while ((c = getopt(argc, argv, "n:s:")) != -1) {
+        switch (c) {
+            case 'n': n = strtoul(optarg, NULL, 10); break;
+            case 's': roundtrip_seed = (uint32_t) strtoul(optarg, NULL, 10); break;
+            default:
+                fprintf(stderr, "usage: %s [-n updates] [-s seed]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (roundtrip_seed == 0) roundtrip_seed = 1;
+
+    memset(&r, 0, sizeof(r));
+    report_delta_encoder_init(&enc);
+    report_delta_decoder_init(&dec);
+
+    for (i = 0; i < n; i++) {
+        // Mostly a few fields at a time, sometimes all of them:
+        changes = (roundtrip_rand() % 64 == 0) ? ROUNDTRIP_FIELDS : 1 + (int) (roundtrip_rand() % 3);
+        for (k = 0; k < changes; k++) {
+            roundtrip_mutate(&r, changes == ROUNDTRIP_FIELDS ? k : (int) (roundtrip_rand() % ROUNDTRIP_FIELDS));
+        }
+
+        len = report_delta_encode(&enc, &r, buf);
+        if (len == 0) continue;
+        if ((len < 0) || (len > REPORT_DELTA_MAX)) {
+            fprintf(stderr, "update %lu: encoded length %d\n", i, len);
+            return 1;
+        }
+        updates++;
+        bytes += len;
+        if (buf[0] & REPORT_DELTA_KEYFRAME) {
+            keyframes++;
+            synced = true;
+        }
+
+        // A truncated update decodes or is rejected without touching the last good report:
+        trunc = dec;
+        k = (int) (roundtrip_rand() % len);
+        if ((report_delta_decode(&trunc, buf, k) != 0) && dec.have_keyframe &&
+            ((field = roundtrip_diff(&trunc.r, &dec.r)) != NULL)) {
+            fprintf(stderr, "update %lu: rejected update cut to %d of %d bytes changed %s\n", i, k, len, field);
+            return 1;
+        }
+
+        if ((i % ROUNDTRIP_DROP_EVERY == 0) && !(buf[0] & REPORT_DELTA_KEYFRAME)) {
+            dropped++;
+            synced = false;
+            continue;
+        }
+
+        if (report_delta_decode(&dec, buf, len) != 0) {
+            fprintf(stderr, "update %lu: decode of %d bytes failed\n", i, len);
+            return 1;
+        }
+        if (synced && ((field = roundtrip_diff(&dec.r, &r)) != NULL)) {
+            fprintf(stderr, "update %lu: decoded %s differs\n", i, field);
+            return 1;
+        }
+    }
+
+    printf("updates      %lu\n", updates);
+    printf("keyframes    %lu\n", keyframes);
+    printf("dropped      %lu\n", dropped);
+    printf("bytes/update %.2f\n", updates ? (double) bytes / (double) updates : 0.0);
+    return 0;
+}
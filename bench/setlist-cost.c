@@ -0,0 +1,193 @@
+/*
+    Whole-setlist MIDI cost analyzer.
+
+    Builds controller.c into this file and walks the set list the way it is played: each song in
+    sl.entries[] is entered with activate_song() from the previous song's last scene, then stepped
+    through its scenes with next_scene(). With -r the set list is walked again from its first song,
+    so presets are revisited once the controller has seen them. Every transition runs one controller_handle() and flushes
+    through the null back end's simulated 31250 baud wire (see null/midi-wire.h) on a virtual clock,
+    with `gap` ms of silence before it so transitions do not queue behind each other.
+
+    Prints every transition with the MIDI bytes and messages it sent and the time from the tick to
+    the last byte arriving at the device, then the worst transitions by wire time.
+
+    Programs come from the compiled-in flash banks unless an image file is given with -f. With -s
+    every CC is re-sent after a program change (see midi_strict_pc).
+
+    Usage: eminor3-setlist-cost [-n worst] [-g gap_ms] [-r walks] [-f flash] [-s]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// Brings in types.h and hardware.h:
+#include "controller.c"
+
+#include "flash.h"
+#include "midi.h"
+#include "midi-wire.h"
+
+void debug_log(const char *fmt, ...) {
+    (void) fmt;
+}
+
+// Virtual clock for the wire:
+static uint64_t cost_now_usec = 0;
+
+static uint64_t cost_clock(void) {
+    return cost_now_usec;
+}
+
+// What the ticks of the current transition put on the wire:
+static unsigned long cost_bytes = 0;
+static unsigned long cost_msgs = 0;
+static uint64_t cost_done_usec = 0;
+
+static void cost_observe(const struct midi_wire_tick *t) {
+    cost_bytes += t->bytes;
+    cost_msgs += t->count;
+    cost_done_usec = t->done_usec;
+}
+
+// from_sl of the initial state sent at power on:
+#define COST_POWER_ON 0xFF
+
+struct cost_transition {
+    u8 from_sl, from_sc;
+    u8 to_sl, to_sc;
+    u8 program;
+    unsigned long bytes;
+    unsigned long msgs;
+    uint64_t wire_usec;
+};
+
+// Most walks of the set list:
+#define COST_WALKS_MAX 8
+
+// Power on, then per walk and song its entry and one step per further scene:
+static struct cost_transition cost_transitions[COST_WALKS_MAX * max_set_length * scene_count_max + 1];
+static int cost_n = 0;
+
+// Run the change just made to `curr` through one controller tick and record what it cost:
+static void cost_tick(u8 from_sl, u8 from_sc, unsigned long gap_ms) {
+    struct cost_transition *c;
+    uint64_t start;
+
+    cost_now_usec += (uint64_t) gap_ms * 1000;
+    start = cost_now_usec;
+    cost_bytes = 0;
+    cost_msgs = 0;
+    cost_done_usec = start;
+
+    controller_handle();
+    midi_flush();
+
+    if (cost_n == sizeof(cost_transitions) / sizeof(cost_transitions[0])) {
+        fprintf(stderr, "setlist-cost: more than %d transitions\n", cost_n);
+        exit(2);
+    }
+    c = &cost_transitions[cost_n++];
+    c->from_sl = from_sl;
+    c->from_sc = from_sc;
+    c->to_sl = curr.sl_idx;
+    c->to_sc = curr.sc_idx;
+    c->program = sl.entries[curr.sl_idx].program;
+    c->bytes = cost_bytes;
+    c->msgs = cost_msgs;
+    c->wire_usec = cost_done_usec - start;
+}
+
+static void cost_print(const struct cost_transition *c) {
+    char from[16];
+
+    if (c->from_sl == COST_POWER_ON) {
+        snprintf(from, sizeof(from), "on");
+    } else {
+        snprintf(from, sizeof(from), "%d.%d", c->from_sl + 1, c->from_sc + 1);
+    }
+    printf("%6s -> %3d.%d  %-20.20s  %5lu  %4lu  %7.2f\n", from, c->to_sl + 1, c->to_sc + 1,
+           pr_names[c->program], c->bytes, c->msgs, c->wire_usec / 1000.0);
+}
+
+// Worst wire time first, then most bytes:
+static int cost_compare(const void *a, const void *b) {
+    const struct cost_transition *x = a, *y = b;
+
+    if (x->wire_usec != y->wire_usec) return x->wire_usec < y->wire_usec ? 1 : -1;
+    if (x->bytes != y->bytes) return x->bytes < y->bytes ? 1 : -1;
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    unsigned long gap_ms = 2000;
+    int worst = 10, walks = 1;
+    int c, w, s, i, retval;
+    unsigned long total_bytes = 0;
+    uint64_t total_usec = 0;
+
+    while ((c = getopt(argc, argv, "n:g:r:f:s")) != -1) {
+        switch (c) {
+            case 'n': worst = atoi(optarg); break;
+            case 'g': gap_ms = strtoul(optarg, NULL, 10); break;
+            case 'r': walks = atoi(optarg); break;
+            case 'f':
+                flash_fname = optarg;
+                if ((retval = flash_init()) != 0) {
+                    return retval;
+                }
+                break;
+            case 's': midi_strict_pc = true; break;
+            default:
+                fprintf(stderr, "usage: %s [-n worst] [-g gap_ms] [-r walks] [-f flash] [-s]\n", argv[0]);
+                return 1;
+        }
+    }
+    if ((walks < 1) || (walks > COST_WALKS_MAX)) {
+        fprintf(stderr, "setlist-cost: walks must be 1 to %d\n", COST_WALKS_MAX);
+        return 1;
+    }
+
+    midi_wire_clock = cost_clock;
+    midi_wire_observer = cost_observe;
+    midi_wire_log = false;
+
+    // Power on at song 1, scene 1:
+    controller_init();
+    cost_tick(COST_POWER_ON, 0, 0);
+
+    for (w = 0; w < walks; w++) {
+        for (s = 0; s < sl.count; s++) {
+            u8 from_sl = curr.sl_idx, from_sc = curr.sc_idx;
+
+            if ((w > 0) || (s > 0)) {
+                activate_song(s);
+                cost_tick(from_sl, from_sc, gap_ms);
+            }
+            while (curr.sc_idx < pr.scene_count - 1) {
+                from_sc = curr.sc_idx;
+                next_scene();
+                cost_tick(curr.sl_idx, from_sc, gap_ms);
+            }
+        }
+    }
+
+    printf("# %d songs x %d walks, %d transitions, %lu ms apart%s\n", sl.count, walks, cost_n, gap_ms,
+           midi_strict_pc ? ", strict program changes" : "");
+    printf("#  from -> to     program               bytes  msgs  wire ms\n");
+    for (i = 0; i < cost_n; i++) {
+        cost_print(&cost_transitions[i]);
+        total_bytes += cost_transitions[i].bytes;
+        total_usec += cost_transitions[i].wire_usec;
+    }
+    printf("# total %lu bytes, %.2f ms on the wire\n", total_bytes, total_usec / 1000.0);
+
+    qsort(cost_transitions, cost_n, sizeof(cost_transitions[0]), cost_compare);
+    if (worst > cost_n) worst = cost_n;
+    printf("\n# worst %d transitions\n", worst);
+    for (i = 0; i < worst; i++) {
+        cost_print(&cost_transitions[i]);
+    }
+
+    return 0;
+}
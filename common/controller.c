@@ -88,6 +88,9 @@ Press AMP to switch row to AMP mode
 
 #include "program-v5.h"
 #include "hardware.h"
+#include "latency.h"
+#include "report-pub.h"
+#include "gesture.h"
 
 // Hard-coded MIDI channel #s:
 #define gmaj_midi_channel    0
@@ -199,22 +202,93 @@ struct state {
 
 // Current and last state:
 struct state curr, last;
-struct {
-    u8 amp_byp, amp_xy, cab_xy, gain, clean_gain, gate;
-} last_amp[2];
+
+// Gain used for clean and acoustic tones per amp:
+u8 clean_gain[2];
+
+// MIDI CC slots per amp in the order they are sent; FX follow in a block of 5:
+enum midi_slot {
+    MIDI_SLOT_BYP_AMP,
+    MIDI_SLOT_XY_AMP,
+    MIDI_SLOT_XY_CAB,
+    MIDI_SLOT_GAIN,
+    MIDI_SLOT_GATE,
+    MIDI_SLOT_VOLUME,
+    MIDI_SLOT_FX,
+    MIDI_SLOT_count = MIDI_SLOT_FX + 5
+};
+
+// Slot value meaning "leave the device as it is" (e.g. amp X/Y while the amp is bypassed):
+#define MIDI_VALUE_KEEP     0xFF
+// Slot value that never matches a target so the slot gets re-sent:
+#define MIDI_VALUE_INVALID  0x80
+
+// Compiled MIDI state: one CC value per slot per amp:
+struct midi_scene {
+    u8 val[2][MIDI_SLOT_count];
+};
+
+// CC numbers per slot for the loaded program:
+u8 midi_slot_cc[2][MIDI_SLOT_count];
+// Compiled state for each scene of the loaded program, built in load_program:
+struct midi_scene midi_scenes[scene_count_max];
+// State to be sent, the amp settings it was compiled from, and state last sent:
+struct midi_scene midi_target, midi_sent;
+struct amp midi_target_amp[2];
+// Set when midi_target or midi_sent changed and the difference has not been sent yet:
+u8 midi_target_pending = 1;
+
+// Device state after a program change, per Axe-FX preset and slot: what was last sent while that
+// preset was active, recorded when it is left, or MIDI_VALUE_INVALID if unknown. This assumes the
+// device brings a preset back as it was left; midi_strict_pc is for when it does not.
+struct midi_scene midi_preset_model[128];
+// Preset the device was last told to change to:
+#define MIDI_PRESET_NONE    0xFF
+u8 midi_preset_active = MIDI_PRESET_NONE;
+
+#ifdef HWFEAT_MIDI_STRICT_PC
+bool midi_strict_pc = true;
+#else
+bool midi_strict_pc = false;
+#endif
 
 // Loaded setlist:
 struct set_list sl;
 // Loaded program:
 struct program pr;
+// Number of the loaded program:
+u8 pr_num;
+
+// Edits to the loaded program are written back through flash_store once the controller has been
+// idle this many 10ms ticks, or before another program is loaded:
+#define PR_WRITEBACK_TICKS 200
+
+// Loaded program has edits not yet written back; 10ms ticks since the last edit:
+u8 pr_dirty = 0;
+u16 pr_idle_ticks = 0;
+// Number of write-backs issued, and refused by flash_store:
+unsigned long pr_flushes = 0;
+unsigned long pr_flush_failures = 0;
+
+// Name of every program, built once at init for the UX song lists; kept in step with flash by
+// program_store so that listing names never touches flash:
+char pr_names[128][PROGRAM_NAME_LEN];
 
 // BCD-encoded dB value table (from PIC/v4_lookup.h):
 extern rom const u16 dB_bcd_lookup[128];
 
-// Set Axe-FX CC value
-#define midi_axe_cc(cc, val) midi_send_cmd2(0xB, axe_midi_channel, cc, val)
-#define midi_axe_pc(program) midi_send_cmd1(0xC, axe_midi_channel, program)
+// Set Axe-FX CC value at a MIDI_PRIO_* priority:
+#define midi_axe_cc(cc, val, prio) { \
+  midi_set_priority(prio); \
+  midi_send_cmd2(0xB, axe_midi_channel, cc, val); \
+}
+#define midi_axe_pc(program) { \
+  midi_set_priority(MIDI_PRIO_PROGRAM); \
+  midi_send_cmd1(0xC, axe_midi_channel, program); \
+}
+// SysEx is only used for tempo which can wait for audible changes:
 #define midi_axe_sysex_start(fn) { \
+  midi_set_priority(MIDI_PRIO_LOW); \
   midi_send_sysex(0xF0); \
   midi_send_sysex(0x00); \
   midi_send_sysex(0x01); \
@@ -245,6 +319,8 @@ void volume_set(int amp, u8 new_volume);
 
 void midi_invalidate(void);
 
+static void midi_program_changed(u8 program, u8 settled);
+
 void toggle_setlist_mode(void);
 
 void tap_tempo(void);
@@ -261,8 +337,9 @@ static void update_lcd(void);
 
 #ifdef HWFEAT_REPORT
 
-// Initialized in controller_init:
-struct report *report = NULL;
+// Built privately each tick and then published for readers:
+static struct report report_next;
+struct report *report = &report_next;
 
 // Fill in a report structure with latest controller data:
 static void report_build(void) {
@@ -295,6 +372,13 @@ static void report_build(void) {
     report->sc_val = curr.sc_idx + 1u;
     report->sc_max = pr.scene_count;
 
+    // Write-back state:
+    report->dirty_pages = pr_dirty;
+    report->flushes = pr_flushes;
+    report->flush_usec = flash_sync_usec;
+    report->flush_usec_max = flash_sync_usec_max;
+    report->flush_failures = pr_flush_failures;
+
     // Copy amp settings:
     for (int i = 0; i < 2; i++) {
         // Set amp tone:
@@ -305,7 +389,7 @@ static void report_build(void) {
         else
             report->amp[i].tone = AMP_TONE_CLEAN;
 
-        report->amp[i].gain_dirty = last_amp[i].gain;
+        report->amp[i].gain_dirty = midi_sent.val[i][MIDI_SLOT_GAIN];
         // TODO: gain_clean needs fixing controller code to be its own value
 
         report->amp[i].volume = curr.amp[i].volume;
@@ -318,163 +402,184 @@ static void report_build(void) {
         }
     }
 
-    // Notify host that report is updated:
+    // Publish for readers and notify host that report is updated:
+    report_publish(report);
     report_notify();
 }
 
 #endif
 
-// MIDI is sent at a fixed 3,125 bytes/sec transfer rate; 56 bytes takes 175ms to complete.
-// calculate the difference from last MIDI state to current MIDI state and send the difference as MIDI commands:
-static void calc_midi(void) {
+// Priority per slot:
+static rom const u8 midi_slot_prio[MIDI_SLOT_count] = {
+    MIDI_PRIO_HIGH,
+    MIDI_PRIO_HIGH,
+    MIDI_PRIO_HIGH,
+    MIDI_PRIO_NORMAL,
+    MIDI_PRIO_NORMAL,
+    MIDI_PRIO_HIGH,
+    MIDI_PRIO_NORMAL,
+    MIDI_PRIO_NORMAL,
+    MIDI_PRIO_NORMAL,
+    MIDI_PRIO_NORMAL,
+    MIDI_PRIO_NORMAL
+};
+
+// Compile one amp's settings into CC values per slot:
+static void midi_compile_amp(u8 *val, u8 a, const struct amp *amp) {
+    u8 test_fx = 1;
+    u8 i;
+
+    if ((amp->fx & fxm_acoustc) != 0) {
+        // acoustic: amp bypassed, cab Y:
+        val[MIDI_SLOT_BYP_AMP] = 0x00;
+        val[MIDI_SLOT_XY_AMP] = MIDI_VALUE_KEEP;
+        val[MIDI_SLOT_XY_CAB] = 0x00;
+        val[MIDI_SLOT_GAIN] = clean_gain[a];
+        val[MIDI_SLOT_GATE] = 0x00;
+    } else if ((amp->fx & fxm_dirty) != 0) {
+        // dirty: amp X, cab X:
+        val[MIDI_SLOT_BYP_AMP] = 0x7F;
+        val[MIDI_SLOT_XY_AMP] = 0x7F;
+        val[MIDI_SLOT_XY_CAB] = 0x7F;
+        val[MIDI_SLOT_GAIN] = or_default(amp->gain, pr.default_gain[a]);
+        val[MIDI_SLOT_GATE] = 0x7F;
+    } else {
+        // clean: amp Y, cab X:
+        val[MIDI_SLOT_BYP_AMP] = 0x7F;
+        val[MIDI_SLOT_XY_AMP] = 0x00;
+        val[MIDI_SLOT_XY_CAB] = 0x7F;
+        val[MIDI_SLOT_GAIN] = clean_gain[a];
+        val[MIDI_SLOT_GATE] = 0x00;
+    }
+    val[MIDI_SLOT_VOLUME] = amp->volume;
+
+    for (i = 0; i < 5; i++, test_fx <<= 1) {
+        val[MIDI_SLOT_FX + i] = calc_cc_toggle(amp->fx & test_fx);
+    }
+}
+
+// Compile a scene of the loaded program:
+static void midi_compile_scene(u8 sc_idx) {
+    midi_compile_amp(midi_scenes[sc_idx].val[0], 0, &pr.scene[sc_idx].amp[0]);
+    midi_compile_amp(midi_scenes[sc_idx].val[1], 1, &pr.scene[sc_idx].amp[1]);
+}
+
+// Compile CC numbers and every scene of the loaded program:
+static void midi_compile_program(void) {
+    u8 a, i;
+
+    for (a = 0; a < 2; a++) {
+        midi_slot_cc[a][MIDI_SLOT_BYP_AMP] = axe_cc_byp_amp1 + a;
+        midi_slot_cc[a][MIDI_SLOT_XY_AMP] = axe_cc_xy_amp1 + a;
+        midi_slot_cc[a][MIDI_SLOT_XY_CAB] = axe_cc_xy_cab1 + a;
+        midi_slot_cc[a][MIDI_SLOT_GAIN] = axe_cc_external3 + a;
+        midi_slot_cc[a][MIDI_SLOT_GATE] = axe_cc_byp_gate1 + a;
+        midi_slot_cc[a][MIDI_SLOT_VOLUME] = axe_cc_external1 + a;
+        for (i = 0; i < 5; i++) {
+            midi_slot_cc[a][MIDI_SLOT_FX + i] = pr.fx_midi_cc[a][i];
+        }
+    }
+
+    for (i = 0; i < scene_count_max; i++) {
+        midi_compile_scene(i);
+    }
+
+    // Recompile the target from curr on the next calc_midi:
+    midi_target_amp[0].fx = ~curr.amp[0].fx;
+    midi_target_pending = 1;
+}
+
+// Send one slot if its target differs from what was last sent; returns 1 if sent:
+static u8 midi_send_slot(u8 a, u8 slot) {
+    u8 val = midi_target.val[a][slot];
+
+    if ((val == MIDI_VALUE_KEEP) || (val == midi_sent.val[a][slot])) {
+        return 0;
+    }
+
+    midi_sent.val[a][slot] = val;
+    DEBUG_LOG3("MIDI amp%d CC %d = 0x%02x", a + 1, midi_slot_cc[a][slot], val);
+    midi_axe_cc(midi_slot_cc[a][slot], val, midi_slot_prio[slot]);
+    return 1;
+}
+
+// Send amp and FX CCs that differ from what was last sent; returns 1 if any were sent:
+static u8 midi_update_amps(void) {
     u8 diff = 0;
     u8 dirty, last_dirty;
     u8 acoustc, last_acoustc;
-    u8 test_fx = 1;
-    u8 i, a;
-
-    // Send MIDI program change:
-    if (curr.midi_program != last.midi_program) {
-        DEBUG_LOG1("MIDI change program %d", curr.midi_program);
-        midi_axe_pc(curr.midi_program);
-        // All bets are off as to what state when changing program:
-        midi_invalidate();
+    u8 i, a, slot;
+
+    // Amp settings edited since the target was compiled:
+    if (memcmp(midi_target_amp, curr.amp, sizeof(midi_target_amp)) != 0) {
+        midi_compile_amp(midi_target.val[0], 0, &curr.amp[0]);
+        midi_compile_amp(midi_target.val[1], 1, &curr.amp[1]);
+        memcpy(midi_target_amp, curr.amp, sizeof(midi_target_amp));
+        midi_target_pending = 1;
     }
 
-    if (curr.setlist_mode != last.setlist_mode) {
-        diff = 1;
+    // Nothing to do until the target or the sent state changes:
+    if (!midi_target_pending) {
+        return 0;
     }
+    midi_target_pending = 0;
 
-    // Send controller changes per amp:
     for (a = 0; a < 2; a++) {
         dirty = curr.amp[a].fx & fxm_dirty;
         acoustc = curr.amp[a].fx & fxm_acoustc;
         last_dirty = last.amp[a].fx & fxm_dirty;
         last_acoustc = last.amp[a].fx & fxm_acoustc;
 
-        if (acoustc != 0) {
-            // acoustic:
-            if (last_amp[a].amp_byp != 0x00) {
-                last_amp[a].amp_byp = 0x00;
-                DEBUG_LOG1("AMP%d off", a + 1);
-                midi_axe_cc(axe_cc_byp_amp1 + a, last_amp[a].amp_byp);
-                diff = 1;
-            }
-            if (last_amp[a].cab_xy != 0x00) {
-                last_amp[a].cab_xy = 0x00;
-                DEBUG_LOG1("CAB%d Y", a + 1);
-                midi_axe_cc(axe_cc_xy_cab1 + a, last_amp[a].cab_xy);
-                diff = 1;
-            }
-            if (last_amp[a].gain != last_amp[a].clean_gain) {
-                last_amp[a].gain = last_amp[a].clean_gain;
-                DEBUG_LOG2("Gain%d 0x%02x", a + 1, last_amp[a].gain);
-                midi_axe_cc(axe_cc_external3 + a, last_amp[a].gain);
-                diff = 1;
-            }
-            if (last_amp[a].gate != 0x00) {
-                last_amp[a].gate = 0x00;
-                DEBUG_LOG1("Gate%d off", a + 1);
-                midi_axe_cc(axe_cc_byp_gate1 + a, last_amp[a].gate);
-                diff = 1;
-            }
-        } else if (dirty != 0) {
-            // dirty:
-            u8 gain = or_default(curr.amp[a].gain, pr.default_gain[a]);
-            if (last_amp[a].amp_byp != 0x7F) {
-                last_amp[a].amp_byp = 0x7F;
-                DEBUG_LOG1("AMP%d on", a + 1);
-                midi_axe_cc(axe_cc_byp_amp1 + a, last_amp[a].amp_byp);
-                diff = 1;
-            }
-            if (last_amp[a].amp_xy != 0x7F) {
-                last_amp[a].amp_xy = 0x7F;
-                DEBUG_LOG1("AMP%d X", a + 1);
-                midi_axe_cc(axe_cc_xy_amp1 + a, last_amp[a].amp_xy);
-                diff = 1;
-            }
-            if (last_amp[a].cab_xy != 0x7F) {
-                last_amp[a].cab_xy = 0x7F;
-                DEBUG_LOG1("CAB%d X", a + 1);
-                midi_axe_cc(axe_cc_xy_cab1 + a, last_amp[a].cab_xy);
-                diff = 1;
-            }
-            if (last_amp[a].gain != gain) {
-                last_amp[a].gain = gain;
-                DEBUG_LOG2("Gain%d 0x%02x", a + 1, last_amp[a].gain);
-                midi_axe_cc(axe_cc_external3 + a, last_amp[a].gain);
-                diff = 1;
-            }
-            if (last_amp[a].gate != 0x7F) {
-                last_amp[a].gate = 0x7F;
-                DEBUG_LOG1("Gate%d on", a + 1);
-                midi_axe_cc(axe_cc_byp_gate1 + a, last_amp[a].gate);
-                diff = 1;
-            }
-        } else {
-            // clean:
-            if (last_amp[a].amp_byp != 0x7F) {
-                last_amp[a].amp_byp = 0x7F;
-                DEBUG_LOG1("AMP%d on", a + 1);
-                midi_axe_cc(axe_cc_byp_amp1 + a, last_amp[a].amp_byp);
-                diff = 1;
-            }
-            if (last_amp[a].amp_xy != 0x00) {
-                last_amp[a].amp_xy = 0x00;
-                DEBUG_LOG1("AMP%d Y", a + 1);
-                midi_axe_cc(axe_cc_xy_amp1 + a, last_amp[a].amp_xy);
-                diff = 1;
-            }
-            if (last_amp[a].cab_xy != 0x7F) {
-                last_amp[a].cab_xy = 0x7F;
-                DEBUG_LOG1("CAB%d X", a + 1);
-                midi_axe_cc(axe_cc_xy_cab1 + a, last_amp[a].cab_xy);
-                diff = 1;
-            }
-            if (last_amp[a].gain != last_amp[a].clean_gain) {
-                last_amp[a].gain = last_amp[a].clean_gain;
-                DEBUG_LOG2("Gain%d 0x%02x", a + 1, last_amp[a].gain);
-                midi_axe_cc(axe_cc_external3 + a, last_amp[a].gain);
-                diff = 1;
-            }
-            if (last_amp[a].gate != 0x00) {
-                last_amp[a].gate = 0x00;
-                DEBUG_LOG1("Gate%d off", a + 1);
-                midi_axe_cc(axe_cc_byp_gate1 + a, last_amp[a].gate);
-                diff = 1;
-            }
+        for (slot = MIDI_SLOT_BYP_AMP; slot <= MIDI_SLOT_GATE; slot++) {
+            diff |= midi_send_slot(a, slot);
         }
 
         if ((last_acoustc | last_dirty) != (acoustc | dirty)) {
             // Always compressor on:
             DEBUG_LOG1("Comp%d on", a + 1);
-            midi_axe_cc(axe_cc_byp_compressor1 + a, 0x7F);
+            midi_axe_cc(axe_cc_byp_compressor1 + a, 0x7F, MIDI_PRIO_LOW);
         }
 
         // Update volumes:
-        if (curr.amp[a].volume != last.amp[a].volume) {
-            DEBUG_LOG2("MIDI set AMP%d volume = %s", a + 1, bcd(dB_bcd_lookup[curr.amp[a].volume]));
-            midi_axe_cc(axe_cc_external1 + a, (curr.amp[a].volume));
-            diff = 1;
-        }
+        diff |= midi_send_slot(a, MIDI_SLOT_VOLUME);
     }
 
     // Send FX state:
-    for (i = 0; i < 5; i++, test_fx <<= 1) {
-        if ((curr.amp[0].fx & test_fx) != (last.amp[0].fx & test_fx)) {
-            DEBUG_LOG2("MIDI set AMP1 %.4s %s", fx_name(pr.fx_midi_cc[0][i]),
-                       (curr.amp[0].fx & test_fx) == 0 ? "off" : "on");
-            midi_axe_cc(pr.fx_midi_cc[0][i], calc_cc_toggle(curr.amp[0].fx & test_fx));
-            diff = 1;
-        }
-        if ((curr.amp[1].fx & test_fx) != (last.amp[1].fx & test_fx)) {
-            DEBUG_LOG2("MIDI set AMP2 %.4s %s", fx_name(pr.fx_midi_cc[1][i]),
-                       (curr.amp[1].fx & test_fx) == 0 ? "off" : "on");
-            midi_axe_cc(pr.fx_midi_cc[1][i], calc_cc_toggle(curr.amp[1].fx & test_fx));
-            diff = 1;
-        }
+    for (i = 0; i < 5; i++) {
+        diff |= midi_send_slot(0, MIDI_SLOT_FX + i);
+        diff |= midi_send_slot(1, MIDI_SLOT_FX + i);
     }
 
+    return diff;
+}
+
+// MIDI is sent at a fixed 3,125 bytes/sec transfer rate; 56 bytes takes 17.9ms to complete.
+// Messages are tagged with a priority so amp bypass/XY and volume go out right after the program
+// change while gain, gate and FX follow and compressor and tempo SysEx go last.
+// CC values are compiled per scene in load_program; the target is only recompiled here when the
+// current amp settings were edited away from the scene they were loaded from.
+// calculate the difference from last MIDI state to current MIDI state and send the difference as MIDI commands:
+static void calc_midi(void) {
+    u8 diff = 0;
+
+    // Send MIDI program change:
+    if (curr.midi_program != last.midi_program) {
+        // The program change drops anything still queued, so what was sent is only known if nothing is:
+        u8 settled = (midi_queue_len() == 0);
+
+        DEBUG_LOG1("MIDI change program %d", curr.midi_program);
+        midi_axe_pc(curr.midi_program);
+        // Re-send what the new preset may not have kept:
+        midi_program_changed(curr.midi_program, settled);
+    }
+
+    if (curr.setlist_mode != last.setlist_mode) {
+        diff = 1;
+    }
+
+    // Send amp and FX changes:
+    diff |= midi_update_amps();
+
     // Send MIDI tempo change:
     if ((curr.tempo != last.tempo) && (curr.tempo >= 30)) {
         // http://forum.fractalaudio.com/threads/is-it-possible-to-set-tempo-on-the-axe-fx-ii-via-sysex.101437/
@@ -681,7 +786,7 @@ static void update_lcd(void) {
                 // C/D for clean/dirty
                 lcd_rows[row_amp1][1] = 'C' + ((curr.amp[0].fx & fxm_dirty) != 0);
             }
-            hextoa(lcd_rows[row_amp1], 5, last_amp[0].gain);
+            hextoa(lcd_rows[row_amp1], 5, midi_sent.val[0][MIDI_SLOT_GAIN]);
             bcdtoa(lcd_rows[row_amp1], 13, dB_bcd_lookup[curr.amp[0].volume]);
 
             test_fx = 1;
@@ -735,7 +840,7 @@ static void update_lcd(void) {
                 // C/D for clean/dirty
                 lcd_rows[row_amp2][1] = 'C' + ((curr.amp[1].fx & fxm_dirty) != 0);
             }
-            hextoa(lcd_rows[row_amp2], 5, last_amp[1].gain);
+            hextoa(lcd_rows[row_amp2], 5, midi_sent.val[1][MIDI_SLOT_GAIN]);
             bcdtoa(lcd_rows[row_amp2], 13, dB_bcd_lookup[curr.amp[1].volume]);
 
             test_fx = 1;
@@ -800,16 +905,71 @@ static void calc_volume_modified(void) {
     // DEBUG_LOG1("calc_volume_modified(): 0x%02X", curr.modified);
 }
 
+// Flash address of program `pr`:
+static u16 program_flash_addr(u8 pr) {
+    return (u16) sizeof(struct set_list) + (u16) (pr * sizeof(struct program));
+}
+
 rom struct program *program_addr(u8 pr) {
-    u16 addr = (u16) sizeof(struct set_list) + (u16) (pr * sizeof(struct program));
+    return (rom struct program *) flash_addr(program_flash_addr(pr));
+}
 
-    return (rom struct program *) flash_addr(addr);
+// Store `p` to flash as program `pr`; every program store goes through here so the name index
+// follows flash. Returns flash_store's result:
+static int program_store(u8 pr, const struct program *p) {
+    if (flash_store(program_flash_addr(pr), sizeof(struct program), (u8 *) p) != 0) {
+        return -1;
+    }
+
+    memcpy(pr_names[pr], p->name, PROGRAM_NAME_LEN);
+    return 0;
+}
+
+// Mark the loaded program as edited:
+static void program_touch(void) {
+    pr_dirty = 1;
+    pr_idle_ticks = 0;
+}
+
+// Write the loaded program, with the current scene's settings, back to flash if it was edited. A
+// refused store leaves the program dirty to be retried after another idle period:
+static void program_writeback(void) {
+    struct program tmp;
+
+    if (!pr_dirty) return;
+    pr_dirty = 0;
+
+    tmp = pr;
+    tmp.scene[curr.sc_idx].amp[0] = curr.amp[0];
+    tmp.scene[curr.sc_idx].amp[1] = curr.amp[1];
+    if (memcmp(&tmp, (const void *) origpr, sizeof(struct program)) == 0) {
+        // Edited back to what is already stored:
+        return;
+    }
+
+    DEBUG_LOG1("write back program %d", pr_num + 1);
+    if (program_store(pr_num, &tmp) != 0) {
+        pr_flush_failures++;
+        pr_dirty = 1;
+        pr_idle_ticks = 0;
+        return;
+    }
+    pr_flushes++;
+
+    // Stored copy now matches:
+    calc_volume_modified();
+    calc_fx_modified();
+    calc_gain_modified();
 }
 
 void load_program(void) {
     // Load program:
     u16 addr;
-    u8 pr_num;
+
+    // Save edits to the program being left; if flash refuses them they are lost (and counted in
+    // pr_flush_failures) and the program being loaded starts clean:
+    program_writeback();
+    pr_dirty = 0;
 
     if (curr.setlist_mode == 0) {
         pr_num = curr.pr_idx;
@@ -819,7 +979,7 @@ void load_program(void) {
 
     DEBUG_LOG1("load program %d", pr_num + 1);
 
-    addr = (u16) sizeof(struct set_list) + (u16) (pr_num * sizeof(struct program));
+    addr = program_flash_addr(pr_num);
     flash_load(addr, sizeof(struct program), (u8 *) &pr);
 
     origpr = (rom struct program *) flash_addr(addr);
@@ -836,6 +996,9 @@ void load_program(void) {
         scene_default();
     }
 
+    // Compile MIDI state for every scene:
+    midi_compile_program();
+
     // Trigger a scene reload:
     //last.sc_idx = ~curr.sc_idx;
 }
@@ -849,12 +1012,19 @@ void load_scene(void) {
         // Reset to default scene state:
         //scene_default();
         pr.scene[curr.sc_idx] = pr.scene[curr.sc_idx - 1];
+        midi_compile_scene(curr.sc_idx);
     }
 
     // Copy new scene settings into current state:
     curr.amp[0] = pr.scene[curr.sc_idx].amp[0];
     curr.amp[1] = pr.scene[curr.sc_idx].amp[1];
 
+    // Switch to the scene's precompiled MIDI state:
+    midi_target = midi_scenes[curr.sc_idx];
+    midi_target_amp[0] = curr.amp[0];
+    midi_target_amp[1] = curr.amp[1];
+    midi_target_pending = 1;
+
     // Recalculate modified status for this scene:
     curr.modified = 0;
     calc_volume_modified();
@@ -863,24 +1033,37 @@ void load_scene(void) {
 }
 
 void activate_program(int pr_idx) {
+    if (pr_idx < 0 || pr_idx >= 128) return;
+
     curr.pr_idx = (u8)pr_idx;
     load_program();
     load_scene();
 }
 
 void activate_song(int sl_idx) {
+    if (sl_idx < 0 || sl_idx >= sl.count) return;
+
     curr.sl_idx = (u8)sl_idx;
     load_program();
     load_scene();
 }
 
-void get_program_name(int pr_idx, char *name) {
-    struct program tmp;
+// Build the program name index from flash:
+static void program_names_load(void) {
+    u8 p;
 
-    u16 addr = (u16) sizeof(struct set_list) + (u16) (pr_idx * sizeof(struct program));
-    flash_load(addr, sizeof(struct program), (u8 *) &tmp);
+    for (p = 0; p < 128; p++) {
+        memcpy(pr_names[p], (const void *) program_addr(p)->name, PROGRAM_NAME_LEN);
+    }
+}
+
+void get_program_name(int pr_idx, char *name) {
+    if (pr_idx < 0 || pr_idx >= 128) {
+        name[0] = 0;
+        return;
+    }
 
-    strncpy(name, (const char *)tmp.name, 20);
+    strncpy(name, pr_names[pr_idx], PROGRAM_NAME_LEN);
 }
 
 int get_set_list_program(int sl_idx) {
@@ -934,11 +1117,11 @@ void toggle_setlist_mode() {
 
 void tap_tempo() {
     tap ^= (u8) 0x7F;
-    midi_axe_cc(axe_cc_taptempo, tap);
+    midi_axe_cc(axe_cc_taptempo, tap, MIDI_PRIO_HIGH);
 }
 
-void midi_invalidate() {
-    // Invalidate all current MIDI state so it gets re-sent at end of loop:
+// Invalidate all current MIDI state so it gets re-sent at end of loop:
+static void midi_sent_invalidate(void) {
     DEBUG_LOG0("invalidate MIDI state");
     last.midi_program = ~curr.midi_program;
     last.tempo = ~curr.tempo;
@@ -948,15 +1131,36 @@ void midi_invalidate() {
     last.amp[1].gain = ~curr.amp[1].gain;
     last.amp[1].fx = ~curr.amp[1].fx;
     last.amp[1].volume = ~curr.amp[1].volume;
-    // Initialize to something neither 0x00 or 0x7F so it gets reset:
-    last_amp[0].amp_xy = 0x40;
-    last_amp[0].cab_xy = 0x40;
-    last_amp[0].gain = ~curr.amp[0].gain;
-    last_amp[0].gate = 0x40;
-    last_amp[1].amp_xy = 0x40;
-    last_amp[1].cab_xy = 0x40;
-    last_amp[1].gain = ~curr.amp[1].gain;
-    last_amp[1].gate = 0x40;
+    // Initialize to something no target matches so every slot gets reset:
+    memset(&midi_sent, MIDI_VALUE_INVALID, sizeof(midi_sent));
+    midi_target_pending = 1;
+}
+
+// Invalidate all MIDI state, including what is known about every preset, so nothing is assumed
+// about the device:
+void midi_invalidate() {
+    memset(midi_preset_model, MIDI_VALUE_INVALID, sizeof(midi_preset_model));
+    midi_preset_active = MIDI_PRESET_NONE;
+    midi_sent_invalidate();
+}
+
+// Account for a program change just sent: record how the preset being left was left, then re-send
+// only the slots the new preset's model cannot vouch for. `settled` is false if MIDI was still
+// queued when the change was sent; the change dropped it so the preset being left is not known.
+static void midi_program_changed(u8 program, u8 settled) {
+    if (midi_preset_active != MIDI_PRESET_NONE) {
+        if (settled) {
+            midi_preset_model[midi_preset_active] = midi_sent;
+        } else {
+            memset(&midi_preset_model[midi_preset_active], MIDI_VALUE_INVALID, sizeof(struct midi_scene));
+        }
+    }
+    midi_preset_active = program & 0x7F;
+
+    midi_sent_invalidate();
+    if (!midi_strict_pc) {
+        midi_sent = midi_preset_model[midi_preset_active];
+    }
 }
 
 void prev_scene() {
@@ -1020,12 +1224,19 @@ void gain_set(int amp, u8 new_gain) {
             gain = &pr.default_gain[amp];
         }
     } else {
-        gain = &last_amp[amp].clean_gain;
+        gain = &clean_gain[amp];
     }
 
     if ((*gain) != new_gain) {
         (*gain) = new_gain;
+        // Default and clean gains are compiled into every scene:
+        if (gain != &curr.amp[amp].gain) {
+            midi_compile_program();
+        }
         calc_gain_modified();
+        if (gain != &clean_gain[amp]) {
+            program_touch();
+        }
     }
 }
 
@@ -1033,6 +1244,7 @@ void volume_set(int amp, u8 new_volume) {
     if ((curr.amp[amp].volume) != new_volume) {
         curr.amp[amp].volume = new_volume;
         calc_volume_modified();
+        program_touch();
     }
 }
 
@@ -1042,10 +1254,7 @@ void controller_init(void) {
 
     tap = 0;
 
-#ifdef HWFEAT_REPORT
-    // get writable report location:
-    report = report_target();
-#endif
+    gesture_reset();
 
     mode = MODE_LIVE;
 
@@ -1056,10 +1265,12 @@ void controller_init(void) {
     flash_load((u16) 0, sizeof(struct set_list), (u8 *) &sl);
     sl_max = sl.count - (u8) 1;
 
+    program_names_load();
+
     for (i = 0; i < 2; i++) {
         curr.amp[i].gain = 0;
         last.amp[i].gain = ~(u8) 0;
-        last_amp[i].clean_gain = 0x10;
+        clean_gain[i] = 0x10;
     }
 
     // Load first program in setlist:
@@ -1103,29 +1314,134 @@ void controller_init(void) {
 #endif
 }
 
+// Milliseconds since controller_init, advanced by controller_10msec_timer; the gesture clock:
+unsigned long controller_ms = 0;
+
+#ifdef HWFEAT_FSW_EVENTS
+
+// CLOCK_MONOTONIC in ms at the last controller_10msec_timer call; maps edge times onto controller_ms:
+static unsigned long controller_mono_ms = 0;
+
+// controller_ms of each foot-switch's last edge, by bit index:
+static unsigned long fsw_edge_ms[16];
+
+// When the queued edge on switch `i` happened on the gesture clock; never before its previous edge:
+static unsigned long fsw_event_ms(u8 i, const struct timespec *ts) {
+    unsigned long ts_ms = (unsigned long) ts->tv_sec * 1000UL + (unsigned long) (ts->tv_nsec / 1000000L);
+    unsigned long age = 0, ms;
+
+    if ((long) (controller_mono_ms - ts_ms) > 0) {
+        age = controller_mono_ms - ts_ms;
+    }
+    ms = controller_ms - (age < controller_ms ? age : controller_ms);
+    if ((long) (ms - fsw_edge_ms[i]) < 0) {
+        ms = fsw_edge_ms[i];
+    }
+    fsw_edge_ms[i] = ms;
+    return ms;
+}
+
+static void fsw_events_drain(void) {
+    struct fsw_event ev;
+    u8 i;
+
+    while (fsw_event_next(&ev)) {
+        for (i = 0; (i < 16) && ((ev.fsw & (1u << i)) == 0); i++);
+        if (i == 16) continue;
+
+        latency_edge_time(&ev.ts);
+
+        // Queued edges keep taps shorter than a tick, timed from when they happened:
+        gesture_edge(i, ev.pressed, fsw_event_ms(i, &ev.ts));
+    }
+}
+
+#endif
+
 // called every 10ms
 void controller_10msec_timer(void) {
+    if (pr_dirty && (pr_idle_ticks < PR_WRITEBACK_TICKS)) {
+        pr_idle_ticks++;
+    }
+
+    controller_ms += 10;
+#ifdef HWFEAT_FSW_EVENTS
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        controller_mono_ms = (unsigned long) ts.tv_sec * 1000UL + (unsigned long) (ts.tv_nsec / 1000000L);
+    }
+#endif
+    gesture_tick(controller_ms);
+}
+
+// Feed foot-switch edges seen this tick to the gesture recognizer:
+static void fsw_edges(u16 fsw, u16 last_fsw) {
+    u16 changed = fsw ^ last_fsw;
+    u8 i;
+
+    for (i = 0; changed != 0; i++, changed >>= 1) {
+        if (changed & 1) {
+            gesture_edge(i, (fsw & (1u << i)) != 0, controller_ms);
+        }
+    }
+}
+
+// Foot-switch actions:
+static void gesture_handle(const struct gesture_event *ev) {
+    switch (ev->sw) {
+        case 0:
+            // M_1: previous song, repeating while held:
+            if ((ev->type == GESTURE_PRESS) || (ev->type == GESTURE_REPEAT)) {
+                prev_song();
+            }
+            break;
+        case 1:
+            // M_2: next song, repeating while held:
+            if ((ev->type == GESTURE_PRESS) || (ev->type == GESTURE_REPEAT)) {
+                next_song();
+            }
+            break;
+        case 2:
+            // M_3: next scene; hold to reset to scene 1:
+            if (ev->type == GESTURE_PRESS) {
+                next_scene();
+            } else if (ev->type == GESTURE_HOLD) {
+                reset_scene();
+            }
+            break;
+        default:
+            break;
+    }
 }
 
 // main control loop
 void controller_handle(void) {
+    latency_begin();
+
     // poll foot-switch status:
     u16 tmp = fsw_poll();
     curr.fsw = tmp;
+    latency_mark(LATENCY_FSW_POLL);
 
-#define is_btn_pressed(m) ( \
-    ( ((last.fsw & m) != m) && ((curr.fsw & m) == m) ) || \
-    ( (curr.fsw & (m << 8u)) == (m << 8u) ) \
-)
-
-    if (is_btn_pressed(M_1)) {
-        prev_song();
-    }
-    if (is_btn_pressed(M_2)) {
-        next_song();
+    // Measure this tick if any foot-switch changed:
+    if (curr.fsw != last.fsw) {
+        latency_edge();
     }
-    if (is_btn_pressed(M_3)) {
-        next_scene();
+
+#ifdef HWFEAT_FSW_EVENTS
+    // Take edge times from the back end's event queue rather than this tick's time:
+    fsw_events_drain();
+#endif
+
+    fsw_edges(curr.fsw, last.fsw);
+
+    // Act on press/hold/repeat events, including those that came due in the 10ms timer:
+    {
+        struct gesture_event gev;
+        while (gesture_next(&gev)) {
+            gesture_handle(&gev);
+        }
     }
 
     // Update state:
@@ -1136,11 +1452,19 @@ void controller_handle(void) {
         // Store last state into program for recall:
         pr.scene[last.sc_idx].amp[0] = curr.amp[0];
         pr.scene[last.sc_idx].amp[1] = curr.amp[1];
+        midi_compile_scene(last.sc_idx);
 
         load_scene();
     }
 
+    // Write back edits once idle; never on a tick that handled a foot-switch change:
+    if (pr_dirty && (pr_idle_ticks >= PR_WRITEBACK_TICKS) && (curr.fsw == last.fsw)) {
+        program_writeback();
+    }
+
+    latency_mark(LATENCY_HANDLE);
     calc_midi();
+    latency_mark(LATENCY_CALC_MIDI);
 
     // Record the previous state:
     last = curr;
@@ -0,0 +1,124 @@
+#include <string.h>
+
+#include "types.h"
+#include "gesture.h"
+
+struct gesture_config gesture_config = {
+    .press_ms = 0,
+    .hold_ms = 500,
+    .repeat_delay_ms = 750,
+    .repeat_ms = 100,
+    .double_tap_ms = 300,
+};
+
+// Events queued between controller ticks; the oldest is dropped when full:
+#define GESTURE_QUEUE_SIZE 32
+
+struct gesture_switch {
+    bool down;
+    bool press_sent;
+    bool hold_sent;
+    // last press was released before hold_ms, and when:
+    bool tapped;
+    unsigned long down_ms;
+    unsigned long released_ms;
+    unsigned long next_repeat_ms;
+};
+
+static struct gesture_switch gesture_switches[GESTURE_SWITCH_count];
+
+static struct gesture_event gesture_queue[GESTURE_QUEUE_SIZE];
+static u8 gesture_head = 0, gesture_tail = 0;
+
+static void gesture_put(u8 sw, u8 type) {
+    if ((u8) (gesture_head - gesture_tail) == GESTURE_QUEUE_SIZE) {
+        gesture_tail++;
+    }
+
+    gesture_queue[gesture_head % GESTURE_QUEUE_SIZE].sw = sw;
+    gesture_queue[gesture_head % GESTURE_QUEUE_SIZE].type = type;
+    gesture_head++;
+}
+
+void gesture_reset(void) {
+    memset(gesture_switches, 0, sizeof(gesture_switches));
+    gesture_head = 0;
+    gesture_tail = 0;
+}
+
+static void gesture_press(u8 sw, struct gesture_switch *s) {
+    s->press_sent = true;
+    if (s->tapped && (s->down_ms - s->released_ms < gesture_config.double_tap_ms)) {
+        // A double tap starts a fresh sequence:
+        s->tapped = false;
+        gesture_put(sw, GESTURE_DOUBLE_TAP);
+    }
+    gesture_put(sw, GESTURE_PRESS);
+}
+
+void gesture_edge(u8 sw, bool pressed, unsigned long now_ms) {
+    struct gesture_switch *s;
+
+    if (sw >= GESTURE_SWITCH_count) return;
+    s = &gesture_switches[sw];
+    if (pressed == s->down) return;
+
+    if (pressed) {
+        s->down = true;
+        s->press_sent = false;
+        s->hold_sent = false;
+        s->down_ms = now_ms;
+        s->next_repeat_ms = now_ms + gesture_config.repeat_delay_ms;
+        if (gesture_config.press_ms == 0) {
+            gesture_press(sw, s);
+        }
+        return;
+    }
+
+    s->down = false;
+    if (!s->press_sent) {
+        // Released before press_ms; treat as a bounce:
+        return;
+    }
+
+    s->tapped = !s->hold_sent && (now_ms - s->down_ms < gesture_config.hold_ms);
+    s->released_ms = now_ms;
+    gesture_put(sw, GESTURE_RELEASE);
+}
+
+void gesture_tick(unsigned long now_ms) {
+    u8 sw;
+
+    for (sw = 0; sw < GESTURE_SWITCH_count; sw++) {
+        struct gesture_switch *s = &gesture_switches[sw];
+        if (!s->down) continue;
+
+        unsigned long held = now_ms - s->down_ms;
+
+        if (!s->press_sent) {
+            if (held < gesture_config.press_ms) continue;
+            gesture_press(sw, s);
+        }
+
+        if (!s->hold_sent && (held >= gesture_config.hold_ms)) {
+            s->hold_sent = true;
+            gesture_put(sw, GESTURE_HOLD);
+        }
+
+        // Catch up on repeats at most one per tick so a stalled loop does not burst them:
+        if ((long) (now_ms - s->next_repeat_ms) >= 0) {
+            s->next_repeat_ms = now_ms + gesture_config.repeat_ms;
+            gesture_put(sw, GESTURE_REPEAT);
+        }
+    }
+}
+
+bool gesture_next(struct gesture_event *ev) {
+    if (gesture_tail == gesture_head) {
+        return false;
+    }
+
+    *ev = gesture_queue[gesture_tail % GESTURE_QUEUE_SIZE];
+    gesture_tail++;
+    return true;
+}
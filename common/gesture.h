@@ -0,0 +1,60 @@
+#pragma once
+
+/*
+    Foot-switch gesture recognizer.
+
+    The controller feeds it switch edges (gesture_edge) and the passage of time (gesture_tick) as
+    milliseconds on its own monotonic clock, and drains discrete events (gesture_next). Timing is
+    done entirely here from those timestamps; kernel key auto-repeat is not used.
+
+    Per switch, with the thresholds in gesture_config:
+        GESTURE_PRESS       switch has been down for press_ms (0 = on the edge)
+        GESTURE_DOUBLE_TAP  with PRESS, when the previous press was a tap that was released less
+                            than double_tap_ms ago
+        GESTURE_HOLD        once, when held down for hold_ms
+        GESTURE_REPEAT      when held down for repeat_delay_ms, then every repeat_ms
+        GESTURE_RELEASE     switch released after its PRESS
+
+    NOTE: it is expected that 'types.h' is #included before this file
+*/
+
+#include <stdbool.h>
+
+#define GESTURE_SWITCH_count 16
+
+enum gesture_type {
+    GESTURE_PRESS,
+    GESTURE_DOUBLE_TAP,
+    GESTURE_HOLD,
+    GESTURE_REPEAT,
+    GESTURE_RELEASE
+};
+
+struct gesture_event {
+    // switch bit index (M_1 is 0):
+    u8 sw;
+    u8 type;
+};
+
+// Thresholds in milliseconds:
+struct gesture_config {
+    u16 press_ms;
+    u16 hold_ms;
+    u16 repeat_delay_ms;
+    u16 repeat_ms;
+    u16 double_tap_ms;
+};
+
+extern struct gesture_config gesture_config;
+
+// Forget all switch state and queued events:
+extern void gesture_reset(void);
+
+// Switch `sw` went down or up at `now_ms`:
+extern void gesture_edge(u8 sw, bool pressed, unsigned long now_ms);
+
+// Advance time to `now_ms`, emitting any press, hold and repeat events that came due:
+extern void gesture_tick(unsigned long now_ms);
+
+// Pop the oldest event into `*ev`; returns false when there is none:
+extern bool gesture_next(struct gesture_event *ev);
@@ -49,6 +49,24 @@ extern u16 fsw_poll(void);
 // Explicitly set the state of all 16 LEDs:
 extern void led_set(u16 leds);
 
+#ifdef HWFEAT_FSW_EVENTS
+
+#include <time.h>
+
+// One foot-switch edge with the time it happened (CLOCK_MONOTONIC):
+struct fsw_event {
+    // single switch bit, as in fsw_poll():
+    u16 fsw;
+    bool pressed;
+    struct timespec ts;
+};
+
+// Pop the oldest queued foot-switch edge into `*ev`; returns false when the queue is empty.
+// Edges are queued by fsw_poll(), which still returns the resulting 16-bit state.
+extern bool fsw_event_next(struct fsw_event *ev);
+
+#endif
+
 #ifdef FEAT_LCD
 
 // Example LCD display: http://www.newhavendisplay.com/nhd0420d3znswbbwv3-p-5745.html 4x20 characters
@@ -83,6 +101,30 @@ extern void midi_send_cmd2_impl(u8 cmd_byte, u8 data1, u8 data2);
 // Send a single byte for SysEx:
 extern void midi_send_sysex(u8 byte);
 
+// MIDI message priorities; within a tick, queued messages are sent in this order:
+enum midi_priority {
+    // Program change must precede everything since it resets the device state:
+    MIDI_PRIO_PROGRAM,
+    // Immediately audible changes:
+    MIDI_PRIO_HIGH,
+    MIDI_PRIO_NORMAL,
+    // Changes that can wait for everything else:
+    MIDI_PRIO_LOW,
+
+    MIDI_PRIO_count
+};
+
+// Set the priority of the next MIDI message sent; reverts to MIDI_PRIO_NORMAL after each message:
+extern void midi_set_priority(u8 priority);
+
+// Bytes of MIDI queued but not yet handed to the wire; a program change drops queued channel messages:
+extern u16 midi_queue_len(void);
+
+// After a program change, re-send every CC rather than only those the preset model does not vouch
+// for; set when the device reloads a preset's stored state instead of bringing it back as it was
+// left (default set by HWFEAT_MIDI_STRICT_PC):
+extern bool midi_strict_pc;
+
 // --------------- Flash memory functions:
 
 // Flash addresses are 0-based where 0 is the first available byte of
@@ -91,8 +133,9 @@ extern void midi_send_sysex(u8 byte);
 // Load `count` bytes from flash memory at address `addr` into `data`:
 extern void flash_load(u16 addr, u16 count, u8 *data);
 
-// Stores `count` bytes from `data` into flash memory at address `addr`:
-extern void flash_store(u16 addr, u16 count, u8 *data);
+// Stores `count` bytes from `data` into flash memory at address `addr`; returns 0, or non-zero if the
+// store was refused and flash left unchanged:
+extern int flash_store(u16 addr, u16 count, u8 *data);
 
 // Get a pointer to flash memory at address:
 extern rom const u8 *flash_addr(u16 addr);
@@ -189,14 +232,22 @@ struct report {
     // Scene number
     int sc_val, sc_max;
 
+    // Programs with edits not yet written back, write-backs issued, and how long the last and
+    // slowest flash_store took to reach storage (microseconds):
+    int dirty_pages;
+    unsigned long flushes;
+    unsigned long flush_usec, flush_usec_max;
+    // Write-backs flash_store refused (the program stays dirty and is retried once idle again):
+    unsigned long flush_failures;
+
     // 2 amp reports:
     struct amp_report amp[2];
 };
 
-// Ask the host for a writable report:
-extern struct report *report_target(void);
+// Last and slowest flash_store-to-durable latency in microseconds, kept by the flash back end:
+extern unsigned long flash_sync_usec, flash_sync_usec_max;
 
-// Notify the host that the report was updated:
+// Notify the host that a new report was published (see report-pub.h):
 extern void report_notify(void);
 
 #endif
@@ -0,0 +1,140 @@
+#include "latency.h"
+
+#ifdef HWFEAT_LATENCY
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+// Number of samples kept; oldest samples are overwritten:
+#define LATENCY_RING_SIZE 1024
+
+struct latency_sample {
+    // bit per stage that was marked during the tick:
+    unsigned stages;
+    // microseconds from footswitch edge to each stage:
+    uint32_t usec[LATENCY_STAGE_count];
+};
+
+static const char *latency_stage_names[LATENCY_STAGE_count] = {
+    "fsw_poll",
+    "handle",
+    "calc_midi",
+    "midi_write",
+};
+
+// Single-producer (controller tick) ring; readers only ever copy out of it:
+static struct latency_sample latency_ring[LATENCY_RING_SIZE];
+static atomic_uint latency_head = 0;
+
+// Current tick being measured:
+static struct timespec latency_t0;
+static struct timespec latency_ts[LATENCY_STAGE_count];
+static unsigned latency_stages = 0;
+static int latency_has_edge = 0;
+
+static uint32_t latency_usec(const struct timespec *from, const struct timespec *to) {
+    long long ns = (long long) (to->tv_sec - from->tv_sec) * 1000000000LL + (to->tv_nsec - from->tv_nsec);
+    if (ns < 0) return 0;
+    return (uint32_t) (ns / 1000LL);
+}
+
+// Commit the current tick to the ring if it saw an edge:
+static void latency_commit(void) {
+    struct latency_sample *s;
+    unsigned head;
+    int i;
+
+    if (!latency_has_edge) return;
+    latency_has_edge = 0;
+
+    head = atomic_load_explicit(&latency_head, memory_order_relaxed);
+    s = &latency_ring[head % LATENCY_RING_SIZE];
+    s->stages = latency_stages;
+    for (i = 0; i < LATENCY_STAGE_count; i++) {
+        s->usec[i] = (latency_stages & (1u << i)) ? latency_usec(&latency_t0, &latency_ts[i]) : 0;
+    }
+    atomic_store_explicit(&latency_head, head + 1, memory_order_release);
+}
+
+void latency_init(void) {
+    atexit(latency_dump);
+}
+
+void latency_begin(void) {
+    latency_commit();
+
+    clock_gettime(CLOCK_MONOTONIC, &latency_t0);
+    latency_stages = 0;
+}
+
+void latency_edge(void) {
+    latency_has_edge = 1;
+}
+
+void latency_edge_time(const struct timespec *ts) {
+    latency_t0 = *ts;
+}
+
+void latency_mark(enum latency_stage stage) {
+    clock_gettime(CLOCK_MONOTONIC, &latency_ts[stage]);
+    latency_stages |= 1u << stage;
+}
+
+static int latency_cmp(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+    return (x > y) - (x < y);
+}
+
+void latency_dump(void) {
+    static uint32_t values[LATENCY_RING_SIZE];
+    // Histogram bucket upper bounds for edge to last MIDI byte, in microseconds:
+    static const uint32_t buckets[] = {250, 500, 1000, 2000, LATENCY_BUDGET_USEC, UINT32_MAX};
+    unsigned hist[sizeof(buckets) / sizeof(buckets[0])];
+    unsigned head, count, i, n, b;
+    int stage;
+
+    latency_commit();
+
+    head = atomic_load_explicit(&latency_head, memory_order_acquire);
+    count = head < LATENCY_RING_SIZE ? head : LATENCY_RING_SIZE;
+
+    fprintf(stderr, "latency: %u samples (last %u kept)\n", head, count);
+    if (count == 0) return;
+
+    for (stage = 0; stage < LATENCY_STAGE_count; stage++) {
+        n = 0;
+        for (i = 0; i < count; i++) {
+            const struct latency_sample *s = &latency_ring[(head - 1 - i) % LATENCY_RING_SIZE];
+            if (s->stages & (1u << stage)) {
+                values[n++] = s->usec[stage];
+            }
+        }
+        if (n == 0) continue;
+
+        qsort(values, n, sizeof(values[0]), latency_cmp);
+        fprintf(stderr, "latency: %-10s n=%-5u p50=%6uus p99=%6uus max=%6uus\n",
+                latency_stage_names[stage], n,
+                values[n / 2], values[(n * 99) / 100], values[n - 1]);
+
+        if (stage != LATENCY_MIDI_WRITE) continue;
+
+        // Histogram of edge to last MIDI byte against the budget:
+        memset(hist, 0, sizeof(hist));
+        for (i = 0; i < n; i++) {
+            for (b = 0; values[i] > buckets[b]; b++);
+            hist[b]++;
+        }
+        for (b = 0; b < sizeof(buckets) / sizeof(buckets[0]); b++) {
+            if (buckets[b] == UINT32_MAX) {
+                fprintf(stderr, "latency:   >%5uus %5u  OVER BUDGET\n", buckets[b - 1], hist[b]);
+            } else {
+                fprintf(stderr, "latency:  <=%5uus %5u\n", buckets[b], hist[b]);
+            }
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,60 @@
+#pragma once
+
+/*
+    Optional footswitch-to-MIDI latency instrumentation.
+
+    Enabled with HWFEAT_LATENCY; otherwise every call below compiles away to nothing.
+
+    Each controller tick that sees a footswitch edge records one sample of CLOCK_MONOTONIC
+    timestamps per pipeline stage, relative to the edge. Samples go into a lock-free ring buffer
+    and p50/p99/max per stage are dumped to stderr at exit and when the main loop gets SIGUSR1.
+*/
+
+enum latency_stage {
+    // fsw_poll() returned:
+    LATENCY_FSW_POLL,
+    // controller_handle() updated state and is entering calc_midi():
+    LATENCY_HANDLE,
+    // calc_midi() returned:
+    LATENCY_CALC_MIDI,
+    // last MIDI byte of the tick was written:
+    LATENCY_MIDI_WRITE,
+
+    LATENCY_STAGE_count
+};
+
+// Budget for footswitch edge to last MIDI byte written, in microseconds:
+#define LATENCY_BUDGET_USEC 5000
+
+#ifdef HWFEAT_LATENCY
+
+#include <time.h>
+
+// Register the at-exit dump:
+extern void latency_init(void);
+
+// Start a new controller tick; commits the previous tick's sample if it saw an edge:
+extern void latency_begin(void);
+
+// Flag the current tick as having a footswitch edge:
+extern void latency_edge(void);
+
+// Override the edge timestamp with a more precise one from the input device (CLOCK_MONOTONIC):
+extern void latency_edge_time(const struct timespec *ts);
+
+// Timestamp a stage of the current tick:
+extern void latency_mark(enum latency_stage stage);
+
+// Dump statistics to stderr now:
+extern void latency_dump(void);
+
+#else
+
+#define latency_init()
+#define latency_begin()
+#define latency_edge()
+#define latency_edge_time(ts)
+#define latency_mark(stage)
+#define latency_dump()
+
+#endif
@@ -0,0 +1,272 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "types.h"
+#include "hardware.h"
+#include "midi-queue.h"
+
+struct midi_tick_stats midi_tick;
+
+#ifdef HWFEAT_MIDI_RUNNING_STATUS
+bool midi_running_status = true;
+#else
+bool midi_running_status = false;
+#endif
+
+unsigned long midi_queue_dropped = 0;
+
+void (*midi_queue_observer)(u8 priority, const u8 *msg, u16 count) = NULL;
+
+// One lane of queued messages per priority:
+static u8 midi_lane[MIDI_PRIO_count][MIDI_QUEUE_SIZE];
+static u16 midi_lane_p[MIDI_PRIO_count];
+static u16 midi_queue_p = 0;
+
+// Queued, unsent CC messages by [channel][controller]; 0 if none, else lane * MIDI_QUEUE_SIZE + offset + 1:
+static u16 midi_cc_slot[16][128];
+
+// Priority for the next message queued:
+static u8 midi_priority = MIDI_PRIO_NORMAL;
+
+// Encoded bytes for the wire:
+static u8 midi_out[MIDI_QUEUE_SIZE];
+static u16 midi_out_saved = 0;
+static bool midi_out_program_change = false;
+
+// Last channel status byte sent (0 if none) and when:
+static u8 midi_status = 0;
+static unsigned long midi_status_ms = 0;
+
+void midi_set_priority(u8 priority) {
+    if (priority >= MIDI_PRIO_count) {
+        priority = MIDI_PRIO_LOW;
+    }
+    midi_priority = priority;
+}
+
+static u16 midi_msg_len(const u8 *msg, u16 avail);
+
+// Rebuild the pending CC table after lanes were compacted:
+static void midi_cc_slots_rebuild(void) {
+    u8 prio;
+
+    memset(midi_cc_slot, 0, sizeof(midi_cc_slot));
+    for (prio = 0; prio < MIDI_PRIO_count; prio++) {
+        const u8 *lane = midi_lane[prio];
+        u16 i = 0;
+
+        while (i < midi_lane_p[prio]) {
+            u16 count = midi_msg_len(&lane[i], midi_lane_p[prio] - i);
+            if (((lane[i] & 0xF0) == 0xB0) && (count == 3)) {
+                midi_cc_slot[lane[i] & 0x0F][lane[i + 1] & 0x7F] = (u16) (prio * MIDI_QUEUE_SIZE + i + 1);
+            }
+            i += count;
+        }
+    }
+}
+
+// Drop every queued channel message for `channel`; a program change supersedes them:
+static void midi_queue_drop_channel(u8 channel) {
+    u8 prio;
+
+    for (prio = 0; prio < MIDI_PRIO_count; prio++) {
+        u8 *lane = midi_lane[prio];
+        u16 i = 0, j = 0;
+
+        while (i < midi_lane_p[prio]) {
+            u16 count = midi_msg_len(&lane[i], midi_lane_p[prio] - i);
+            if ((lane[i] < 0xF0) && ((lane[i] & 0x0F) == channel)) {
+                midi_queue_dropped++;
+            } else {
+                memmove(&lane[j], &lane[i], count);
+                j += count;
+            }
+            i += count;
+        }
+        midi_queue_p -= midi_lane_p[prio] - j;
+        midi_lane_p[prio] = j;
+    }
+
+    midi_cc_slots_rebuild();
+}
+
+void midi_queue_put(const u8 *msg, u16 count) {
+    u8 prio = midi_priority;
+    u16 slot;
+
+    // Priority applies to one message only:
+    midi_priority = MIDI_PRIO_NORMAL;
+
+    if (((msg[0] & 0xF0) == 0xB0) && (count == 3)) {
+        // Replace the value of a CC that has not been sent yet:
+        slot = midi_cc_slot[msg[0] & 0x0F][msg[1] & 0x7F];
+        if (slot != 0) {
+            slot--;
+            midi_lane[slot / MIDI_QUEUE_SIZE][(slot % MIDI_QUEUE_SIZE) + 2] = msg[2];
+            midi_queue_dropped++;
+            return;
+        }
+    } else if ((msg[0] & 0xF0) == 0xC0) {
+        // Values queued for the old program are stale:
+        midi_queue_drop_channel(msg[0] & 0x0F);
+    }
+
+    if (midi_queue_p + count > MIDI_QUEUE_SIZE) {
+        fprintf(stderr, "MIDI queue full (%u + %u > %u bytes); dropping message\n",
+                midi_queue_p, count, MIDI_QUEUE_SIZE);
+        return;
+    }
+
+    if (((msg[0] & 0xF0) == 0xB0) && (count == 3)) {
+        midi_cc_slot[msg[0] & 0x0F][msg[1] & 0x7F] = (u16) (prio * MIDI_QUEUE_SIZE + midi_lane_p[prio] + 1);
+    }
+
+    memcpy(&midi_lane[prio][midi_lane_p[prio]], msg, count);
+    midi_lane_p[prio] += count;
+    midi_queue_p += count;
+}
+
+u16 midi_queue_len(void) {
+    return midi_queue_p;
+}
+
+// Length of the complete message starting at `msg` (at most `avail` bytes):
+static u16 midi_msg_len(const u8 *msg, u16 avail) {
+    u16 n;
+    u8 status = msg[0];
+
+    if (status == 0xF0) {
+        // SysEx runs through the terminating F7:
+        for (n = 1; n < avail && msg[n - 1] != 0xF7; n++);
+        return n;
+    }
+
+    switch (status & 0xF0) {
+        case 0xC0:
+        case 0xD0:
+            n = 2;
+            break;
+        case 0xF0:
+            n = 1;
+            break;
+        default:
+            n = 3;
+            break;
+    }
+
+    return n < avail ? n : avail;
+}
+
+// Append one message to the wire buffer at offset `n` with running status applied:
+static u16 midi_encode_msg(u16 n, const u8 *msg, u16 count, unsigned long now_ms) {
+    u8 status = msg[0];
+
+    if (status < 0xF0) {
+        // Channel voice status:
+        if ((status & 0xF0) == 0xC0) {
+            midi_out_program_change = true;
+        }
+        if (midi_running_status && (status == midi_status)) {
+            midi_out_saved++;
+            msg++;
+            count--;
+        } else {
+            midi_status = status;
+            midi_status_ms = now_ms;
+        }
+    } else if (status < 0xF8) {
+        // SysEx and system common messages cancel running status:
+        midi_status = 0;
+    }
+    // System real-time messages do not affect running status.
+
+    memcpy(&midi_out[n], msg, count);
+    return n + count;
+}
+
+u16 midi_queue_encode(const u8 **data, unsigned long now_ms, u16 max_bytes) {
+    u16 n = 0;
+    u8 prio;
+    bool full = false;
+
+    midi_out_saved = 0;
+    midi_out_program_change = false;
+
+    // Running status expires after a quiet period:
+    if (now_ms - midi_status_ms > MIDI_RUNNING_STATUS_TIMEOUT_MS) {
+        midi_status = 0;
+    }
+
+    // Drain lanes highest priority first, preserving order within each lane:
+    for (prio = 0; prio < MIDI_PRIO_count; prio++) {
+        u8 *lane = midi_lane[prio];
+        u16 i = 0;
+
+        while (!full && (i < midi_lane_p[prio])) {
+            u16 count = midi_msg_len(&lane[i], midi_lane_p[prio] - i);
+
+            // Leave the rest queued, where later CC values can still replace it, if the wire is busy:
+            if (n + count > max_bytes) {
+                full = true;
+                break;
+            }
+
+            if (midi_queue_observer != NULL) {
+                midi_queue_observer(prio, &lane[i], count);
+            }
+
+            n = midi_encode_msg(n, &lane[i], count, now_ms);
+            i += count;
+        }
+
+        // Remove the messages encoded from the front of the lane:
+        if (i > 0) {
+            memmove(lane, &lane[i], midi_lane_p[prio] - i);
+            midi_lane_p[prio] -= i;
+            midi_queue_p -= i;
+        }
+    }
+
+    midi_cc_slots_rebuild();
+
+    *data = midi_out;
+    return n;
+}
+
+unsigned long midi_queue_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long) ts.tv_sec * 1000UL + (unsigned long) (ts.tv_nsec / 1000000L);
+}
+
+void midi_queue_reset_status(void) {
+    midi_status = 0;
+}
+
+void midi_queue_flushed(u16 bytes, u16 syscalls) {
+    midi_tick.saved = midi_out_saved;
+    midi_tick.total_saved += midi_out_saved;
+    if (midi_out_program_change) {
+        midi_tick.saved_program_change = midi_out_saved;
+    }
+
+    midi_tick.bytes = bytes;
+    midi_tick.syscalls = syscalls;
+    if (bytes > midi_tick.max_bytes) midi_tick.max_bytes = bytes;
+    if (syscalls > midi_tick.max_syscalls) midi_tick.max_syscalls = syscalls;
+
+    midi_tick.total_bytes += bytes;
+    midi_tick.total_syscalls += syscalls;
+    midi_tick.total_ticks++;
+}
+
+void midi_queue_log(const u8 *data, u16 count) {
+    u16 i;
+
+    fprintf(stderr, "MIDI:");
+    for (i = 0; i < count; i++) {
+        fprintf(stderr, " %02X", data[i]);
+    }
+    fprintf(stderr, "\n");
+}
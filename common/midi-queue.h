@@ -0,0 +1,84 @@
+#pragma once
+
+/*
+    Per-tick MIDI output queue shared by the MIDI back ends.
+
+    midi_send_cmd1_impl, midi_send_cmd2_impl and midi_send_sysex only queue complete messages here;
+    the back end's midi_flush() writes what was queued during one controller_handle() pass at once.
+
+    Each message goes into the lane for the priority set by midi_set_priority(). Lanes drain highest
+    priority first so audible changes reach the device before the rest of a scene change.
+
+    Messages stay queued until the back end has room on the wire for them. A CC for a (channel,
+    controller) that is still queued replaces the queued value in place, and a program change drops
+    everything queued for its channel, so superseded values never reach the wire.
+
+    When running status is enabled, the encoder drops channel status bytes that repeat the last one
+    sent. Status is re-sent after SysEx/system common messages, after a write error, and when no
+    status byte has been sent for MIDI_RUNNING_STATUS_TIMEOUT_MS.
+
+    NOTE: it is expected that 'types.h' and 'hardware.h' are #included before this file
+*/
+
+#include <stdbool.h>
+
+// Maximum bytes queued per tick:
+#define MIDI_QUEUE_SIZE 1024
+
+// Re-send a status byte if the last one went out longer ago than this:
+#define MIDI_RUNNING_STATUS_TIMEOUT_MS 1000
+
+// Enable running status compression (default set by HWFEAT_MIDI_RUNNING_STATUS):
+extern bool midi_running_status;
+
+// Counters for the last flushed tick and running totals:
+struct midi_tick_stats {
+    // bytes and write syscalls for the last flush that had data:
+    u16 bytes;
+    u16 syscalls;
+
+    // worst tick seen:
+    u16 max_bytes;
+    u16 max_syscalls;
+
+    // status bytes dropped by running status for the last flush:
+    u16 saved;
+    // status bytes dropped for the last flush that contained a program change:
+    u16 saved_program_change;
+
+    // totals since start:
+    unsigned long total_bytes;
+    unsigned long total_syscalls;
+    unsigned long total_ticks;
+    unsigned long total_saved;
+};
+
+extern struct midi_tick_stats midi_tick;
+
+// Number of queued messages superseded before they were sent:
+extern unsigned long midi_queue_dropped;
+
+// Called for each message in emitted order during midi_queue_encode() (test mode in the null back end):
+extern void (*midi_queue_observer)(u8 priority, const u8 *msg, u16 count);
+
+// Queue a complete MIDI message for the next flush at the priority set by midi_set_priority():
+extern void midi_queue_put(const u8 *msg, u16 count);
+
+// Bytes waiting to be flushed (before running status encoding):
+extern u16 midi_queue_len(void);
+
+// Monotonic milliseconds for the `now_ms` of midi_queue_encode():
+extern unsigned long midi_queue_now_ms(void);
+
+// Remove as many queued messages as fit in `max_bytes` and encode them for the wire at time `now_ms`.
+// Returns the byte count and points `*data` at them; the caller must write all of them.
+extern u16 midi_queue_encode(const u8 **data, unsigned long now_ms, u16 max_bytes);
+
+// Record the tick's counters after writing the encoded bytes:
+extern void midi_queue_flushed(u16 bytes, u16 syscalls);
+
+// Forget the running status, e.g. after a failed write left the receiver's state unknown:
+extern void midi_queue_reset_status(void);
+
+// Log `count` bytes at `data` to stderr prior to flushing:
+extern void midi_queue_log(const u8 *data, u16 count);
@@ -0,0 +1,216 @@
+#include <stddef.h>
+#include <string.h>
+
+#include "types.h"
+#include "hardware.h"
+#include "report-delta.h"
+
+#ifdef HWFEAT_REPORT
+
+enum report_field_type {
+    RF_BOOL,
+    RF_U8,
+    RF_INT,
+    RF_ULONG,
+    RF_TONE,
+    RF_BYTES
+};
+
+struct report_field {
+    u8 type;
+    u8 size;
+    u16 offset;
+};
+
+#define RF(type, field) { type, sizeof(((struct report *) 0)->field), offsetof(struct report, field) }
+
+#define RF_AMP(a) \
+    RF(RF_TONE, amp[a].tone), \
+    RF(RF_INT, amp[a].gain_dirty), \
+    RF(RF_INT, amp[a].gain_clean), \
+    RF(RF_INT, amp[a].volume), \
+    RF(RF_BOOL, amp[a].fx_enabled[0]), \
+    RF(RF_BOOL, amp[a].fx_enabled[1]), \
+    RF(RF_BOOL, amp[a].fx_enabled[2]), \
+    RF(RF_BOOL, amp[a].fx_enabled[3]), \
+    RF(RF_BOOL, amp[a].fx_enabled[4]), \
+    RF(RF_BYTES, amp[a].fx_midi_cc)
+
+// Field ids are indexes into this table; append only so existing decoders stay compatible:
+static const struct report_field report_fields[] = {
+    RF(RF_BOOL, is_setlist_mode),
+    RF(RF_BYTES, pr_name),
+    RF(RF_U8, tempo),
+    RF(RF_BOOL, is_modified),
+    RF(RF_INT, pr_val),
+    RF(RF_INT, pr_max),
+    RF(RF_INT, sl_val),
+    RF(RF_INT, sl_max),
+    RF(RF_INT, sc_val),
+    RF(RF_INT, sc_max),
+    RF(RF_INT, dirty_pages),
+    RF(RF_ULONG, flushes),
+    RF(RF_ULONG, flush_usec),
+    RF(RF_ULONG, flush_usec_max),
+    RF_AMP(0),
+    RF_AMP(1),
+    RF(RF_ULONG, flush_failures),
+};
+
+#define REPORT_FIELD_count (sizeof(report_fields) / sizeof(report_fields[0]))
+
+static unsigned long report_field_get(const struct report *r, const struct report_field *f) {
+    const u8 *p = (const u8 *) r + f->offset;
+
+    switch (f->type) {
+        case RF_BOOL:
+            return *(const bool *) p;
+        case RF_U8:
+            return *p;
+        case RF_INT:
+            return (unsigned int) *(const int *) p;
+        case RF_ULONG:
+            return *(const unsigned long *) p;
+        case RF_TONE:
+            return (unsigned int) *(const enum amp_tone *) p;
+        default:
+            return 0;
+    }
+}
+
+static void report_field_set(struct report *r, const struct report_field *f, unsigned long v) {
+    u8 *p = (u8 *) r + f->offset;
+
+    switch (f->type) {
+        case RF_BOOL:
+            *(bool *) p = (v != 0);
+            break;
+        case RF_U8:
+            *p = (u8) v;
+            break;
+        case RF_INT:
+            *(int *) p = (int) (unsigned int) v;
+            break;
+        case RF_ULONG:
+            *(unsigned long *) p = v;
+            break;
+        case RF_TONE:
+            *(enum amp_tone *) p = (enum amp_tone) v;
+            break;
+        default:
+            break;
+    }
+}
+
+// Append field `id` of `r` to `out`; returns the new end:
+static u8 *report_field_encode(const struct report *r, u8 id, u8 *out) {
+    const struct report_field *f = &report_fields[id];
+    unsigned long v;
+
+    *out++ = id;
+    if (f->type == RF_BYTES) {
+        memcpy(out, (const u8 *) r + f->offset, f->size);
+        return out + f->size;
+    }
+
+    // Unsigned LEB128:
+    v = report_field_get(r, f);
+    while (v >= 0x80) {
+        *out++ = (u8) (v | 0x80);
+        v >>= 7;
+    }
+    *out++ = (u8) v;
+    return out;
+}
+
+void report_delta_encoder_init(struct report_delta_encoder *e) {
+    memset(e, 0, sizeof(*e));
+    e->have_prev = false;
+}
+
+int report_delta_keyframe(const struct report *r, u8 *out) {
+    u8 *p = out;
+    u8 id;
+
+    *p++ = REPORT_DELTA_KEYFRAME;
+    for (id = 0; id < REPORT_FIELD_count; id++) {
+        p = report_field_encode(r, id, p);
+    }
+
+    return (int) (p - out);
+}
+
+int report_delta_encode(struct report_delta_encoder *e, const struct report *r, u8 *out) {
+    u8 *p = out;
+    u8 id;
+
+    if (!e->have_prev || (e->since_keyframe >= REPORT_DELTA_KEYFRAME_INTERVAL)) {
+        e->prev = *r;
+        e->have_prev = true;
+        e->since_keyframe = 0;
+        return report_delta_keyframe(r, out);
+    }
+
+    *p++ = 0;
+    for (id = 0; id < REPORT_FIELD_count; id++) {
+        const struct report_field *f = &report_fields[id];
+        if (memcmp((const u8 *) r + f->offset, (const u8 *) &e->prev + f->offset, f->size) != 0) {
+            p = report_field_encode(r, id, p);
+        }
+    }
+    if (p == out + 1) {
+        return 0;
+    }
+
+    e->prev = *r;
+    e->since_keyframe++;
+    return (int) (p - out);
+}
+
+void report_delta_decoder_init(struct report_delta_decoder *d) {
+    memset(d, 0, sizeof(*d));
+    d->have_keyframe = false;
+}
+
+int report_delta_decode(struct report_delta_decoder *d, const u8 *in, int len) {
+    const u8 *end = in + len;
+    struct report r;
+
+    if (len < 1) return -1;
+
+    if (in[0] & REPORT_DELTA_KEYFRAME) {
+        memset(&r, 0, sizeof(r));
+    } else if (d->have_keyframe) {
+        r = d->r;
+    } else {
+        return -1;
+    }
+
+    // Decode into a copy so a malformed update leaves the last good report intact:
+    for (in++; in < end;) {
+        u8 id = *in++;
+        if (id >= REPORT_FIELD_count) return -1;
+
+        const struct report_field *f = &report_fields[id];
+        if (f->type == RF_BYTES) {
+            if (end - in < f->size) return -1;
+            memcpy((u8 *) &r + f->offset, in, f->size);
+            in += f->size;
+        } else {
+            unsigned long v = 0;
+            int shift = 0;
+            do {
+                if ((in >= end) || (shift >= (int) (sizeof(v) * 8))) return -1;
+                v |= (unsigned long) (*in & 0x7F) << shift;
+                shift += 7;
+            } while (*in++ & 0x80);
+            report_field_set(&r, f, v);
+        }
+    }
+
+    d->r = r;
+    d->have_keyframe = true;
+    return 0;
+}
+
+#endif
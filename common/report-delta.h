@@ -0,0 +1,63 @@
+#pragma once
+
+/*
+    Field-level delta encoding of struct report for bandwidth-limited UI feeds (socket, serial).
+
+    An update starts with a flags byte (REPORT_DELTA_KEYFRAME if it carries every field) followed by
+    one record per field that differs from the previous update:
+
+        u8      field id (index into the field table in report-delta.c)
+        value   unsigned LEB128 varint for scalar fields, or the field's fixed bytes (program name,
+                FX CC numbers)
+
+    The encoder sends a keyframe first, every REPORT_DELTA_KEYFRAME_INTERVAL updates, and when asked
+    to, so a decoder that joins late or loses an update resynchronizes. A slider drag that changes
+    one volume encodes to 3 bytes.
+
+    NOTE: it is expected that 'types.h' and 'hardware.h' are #included before this file
+*/
+
+#ifdef HWFEAT_REPORT
+
+#include <stdbool.h>
+
+// Flags byte bits:
+#define REPORT_DELTA_KEYFRAME 0x01
+
+// Updates between keyframes:
+#define REPORT_DELTA_KEYFRAME_INTERVAL 64
+
+// Largest encoded update (a keyframe):
+#define REPORT_DELTA_MAX 256
+
+struct report_delta_encoder {
+    // Last report encoded:
+    struct report prev;
+    // Updates since the last keyframe; a keyframe is due when this reaches the interval:
+    int since_keyframe;
+    bool have_prev;
+};
+
+struct report_delta_decoder {
+    // Report rebuilt from the updates so far:
+    struct report r;
+    bool have_keyframe;
+};
+
+// Reset so the next update is a keyframe:
+extern void report_delta_encoder_init(struct report_delta_encoder *e);
+
+// Encode `r` against the previous update into `out` (REPORT_DELTA_MAX bytes); returns the length.
+// Returns 0 if nothing changed and no keyframe is due.
+extern int report_delta_encode(struct report_delta_encoder *e, const struct report *r, u8 *out);
+
+// Encode `r` as a keyframe without touching any encoder state; returns the length:
+extern int report_delta_keyframe(const struct report *r, u8 *out);
+
+extern void report_delta_decoder_init(struct report_delta_decoder *d);
+
+// Apply one update to `d->r`. Returns 0 on success, -1 if the update is malformed or is a delta
+// received before any keyframe (the decoder then waits for the next keyframe).
+extern int report_delta_decode(struct report_delta_decoder *d, const u8 *in, int len);
+
+#endif
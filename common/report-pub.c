@@ -0,0 +1,72 @@
+#include <string.h>
+#include <stdatomic.h>
+
+#include "types.h"
+#include "hardware.h"
+#include "report-pub.h"
+
+#ifdef HWFEAT_REPORT
+
+// Report stored as machine words so readers and the writer only ever touch it with atomic accesses:
+#define REPORT_WORDS ((sizeof(struct report) + sizeof(unsigned long) - 1) / sizeof(unsigned long))
+
+// Odd while a publish is in progress; advances by 2 per report:
+static atomic_ulong report_seqlock = 0;
+static atomic_ulong report_words[REPORT_WORDS];
+
+static atomic_ulong report_retries = 0;
+
+void report_publish(const struct report *r) {
+    unsigned long words[REPORT_WORDS];
+    unsigned long seq;
+    size_t i;
+
+    words[REPORT_WORDS - 1] = 0;
+    memcpy(words, r, sizeof(*r));
+
+    seq = atomic_load_explicit(&report_seqlock, memory_order_relaxed);
+    atomic_store_explicit(&report_seqlock, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    for (i = 0; i < REPORT_WORDS; i++) {
+        atomic_store_explicit(&report_words[i], words[i], memory_order_relaxed);
+    }
+
+    atomic_store_explicit(&report_seqlock, seq + 2, memory_order_release);
+}
+
+unsigned long report_read(struct report *out) {
+    unsigned long words[REPORT_WORDS];
+    unsigned long seq1, seq2;
+    size_t i;
+
+    while (1) {
+        seq1 = atomic_load_explicit(&report_seqlock, memory_order_acquire);
+        if ((seq1 & 1) == 0) {
+            for (i = 0; i < REPORT_WORDS; i++) {
+                words[i] = atomic_load_explicit(&report_words[i], memory_order_relaxed);
+            }
+            atomic_thread_fence(memory_order_acquire);
+            seq2 = atomic_load_explicit(&report_seqlock, memory_order_relaxed);
+            if (seq1 == seq2) {
+                break;
+            }
+        }
+
+        // A publish overlapped the copy:
+        atomic_fetch_add_explicit(&report_retries, 1, memory_order_relaxed);
+    }
+
+    memcpy(out, words, sizeof(*out));
+    return seq1 / 2;
+}
+
+unsigned long report_seq(void) {
+    return atomic_load_explicit(&report_seqlock, memory_order_acquire) / 2;
+}
+
+unsigned long report_read_retries(void) {
+    return atomic_load_explicit(&report_retries, memory_order_relaxed);
+}
+
+#endif
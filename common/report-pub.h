@@ -0,0 +1,28 @@
+#pragma once
+
+/*
+    Lock-free publication of the controller's struct report to any number of readers.
+
+    The controller builds each report privately and hands it to report_publish(), which copies it
+    into a single seqlock-protected slot and never waits on readers. Readers (the tty UX, a status
+    server, a logger) call report_read() from any thread to copy out the latest complete report;
+    a read that overlaps a publish is retried, so readers never see a torn report.
+
+    NOTE: it is expected that 'types.h' and 'hardware.h' are #included before this file
+*/
+
+#ifdef HWFEAT_REPORT
+
+// Publish `r` as the latest report (controller thread only):
+extern void report_publish(const struct report *r);
+
+// Copy the latest report into `out`; returns its sequence number (0 if none was published yet):
+extern unsigned long report_read(struct report *out);
+
+// Sequence number of the latest report; cheap check for whether report_read() would return news:
+extern unsigned long report_seq(void);
+
+// Reads that overlapped a publish and had to be retried:
+extern unsigned long report_read_retries(void);
+
+#endif
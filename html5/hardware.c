@@ -27,9 +27,10 @@ void flash_load(u16 addr, u16 count, u8 *data)
 }
 
 // Stores `count` bytes from `data` into flash memory at address `addr`:
-void flash_store(u16 addr, u16 count, u8 *data)
+int flash_store(u16 addr, u16 count, u8 *data)
 {
 	memcpy((void *)&flash_memory[addr], (void *)data, count);
+	return 0;
 }
 
 rom const u8 *flash_addr(u16 addr) {
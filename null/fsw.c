@@ -5,6 +5,10 @@ int fsw_init(void) {
     return 0;
 }
 
+int fsw_poll_fd(void) {
+    return -1;
+}
+
 u16 fsw_poll(void) {
     return 0;
 }
@@ -0,0 +1,34 @@
+#pragma once
+
+/*
+    Test mode for the null MIDI back end, enabled with HWFEAT_MIDI_RECORD.
+
+    Every message flushed is recorded in the order it was emitted along with its priority so the
+    MIDI scheduler's ordering can be checked without hardware. eminor3-midi-order (bench/midi-order.c)
+    walks the set list with it, checks that every flush drains higher priorities first and diffs the
+    recorded order against bench/traces/setlist.midi-order.
+
+    NOTE: it is expected that 'types.h' is #included before this file
+*/
+
+#include <stdio.h>
+#include <stdbool.h>
+
+// Maximum messages and bytes recorded:
+#define MIDI_RECORD_MAX       1024
+#define MIDI_RECORD_BYTES_MAX 8192
+
+// Discard anything recorded so far:
+extern void midi_record_start(void);
+
+// Number of messages recorded:
+extern int midi_record_count(void);
+
+// Get recorded message `i`; returns its length:
+extern u16 midi_record_get(int i, u8 *priority, const u8 **msg);
+
+// Print recorded messages starting at message `from` as "MIDI[prio]: bytes" lines:
+extern void midi_record_dump(FILE *f, int from);
+
+// Dump each flush's recorded messages to stderr (default true):
+extern bool midi_record_log;
@@ -0,0 +1,72 @@
+#pragma once
+
+/*
+    Simulated MIDI link for the null back end.
+
+    Every midi_flush() puts the tick's encoded bytes on a virtual 31250 baud wire behind whatever is
+    still being sent from earlier ticks. Each byte takes MIDI_WIRE_BYTE_USEC (start bit, 8 data
+    bits, stop bit), so the simulation records, per message, when its last byte would arrive at the
+    device. Running status is accounted for since timing is taken from the encoded bytes.
+
+    Time comes from midi_wire_clock; hosts that drive the controller on a virtual clock set it so
+    runs are reproducible and need not wait for real time to pass.
+
+    NOTE: it is expected that 'types.h' is #included before this file
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// 10 bits per byte at 31250 baud:
+#define MIDI_WIRE_BYTE_USEC 320
+
+// Messages recorded per tick; any more are still timed but not listed:
+#define MIDI_WIRE_TICK_MSGS 256
+
+// Encoded bytes kept per tick (at least MIDI_QUEUE_SIZE):
+#define MIDI_WIRE_TICK_BYTES 1024
+
+struct midi_wire_msg {
+    // offset and length of the message in the tick's encoded bytes:
+    u16 offset;
+    u16 count;
+    // when its last byte arrives at the device:
+    uint64_t arrive_usec;
+};
+
+// Timing of the last flush that sent anything:
+struct midi_wire_tick {
+    // when midi_flush ran, and when its first byte could start (after earlier ticks drained):
+    uint64_t flush_usec;
+    uint64_t start_usec;
+    // when its last byte arrives:
+    uint64_t done_usec;
+
+    u16 bytes;
+    int count;
+    struct midi_wire_msg msgs[MIDI_WIRE_TICK_MSGS];
+    // encoded bytes, indexed by the messages:
+    u8 data[MIDI_WIRE_TICK_BYTES];
+};
+
+extern struct midi_wire_tick midi_wire_tick;
+
+// Worst flush-to-last-byte time of any tick, and totals since midi_wire_reset:
+extern uint64_t midi_wire_worst_usec;
+extern unsigned long midi_wire_total_bytes;
+extern unsigned long midi_wire_total_ticks;
+
+// Microsecond clock for wire timing; CLOCK_MONOTONIC when NULL:
+extern uint64_t (*midi_wire_clock)(void);
+
+// Called after each flush that sent anything, once midi_wire_tick is filled in:
+extern void (*midi_wire_observer)(const struct midi_wire_tick *t);
+
+// Log each message's arrival time to stderr on flush (default true):
+extern bool midi_wire_log;
+
+// Empty the wire and clear the totals:
+extern void midi_wire_reset(void);
+
+// When everything sent so far will have arrived:
+extern uint64_t midi_wire_idle_at(void);
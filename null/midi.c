@@ -1,12 +1,80 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include <string.h>
+#include <time.h>
 
 #include "types.h"
 #include "hardware.h"
+#include "latency.h"
+#include "midi-queue.h"
+#include "midi-wire.h"
+
+#ifdef HWFEAT_MIDI_RECORD
+#include "midi-record.h"
+
+static struct {
+    u8 priority;
+    u16 offset;
+    u16 count;
+} midi_record[MIDI_RECORD_MAX];
+static u8 midi_record_bytes[MIDI_RECORD_BYTES_MAX];
+static int midi_record_n = 0;
+static u16 midi_record_p = 0;
+
+static const char *midi_priority_names[MIDI_PRIO_count] = {"PROG", "HIGH", "NORM", "LOW "};
+
+bool midi_record_log = true;
+
+// Observe messages in the order the queue emits them:
+static void midi_record_observe(u8 priority, const u8 *msg, u16 count) {
+    if ((midi_record_n >= MIDI_RECORD_MAX) || (midi_record_p + count > MIDI_RECORD_BYTES_MAX)) {
+        fprintf(stderr, "MIDI record full; not recording message\n");
+        return;
+    }
+
+    midi_record[midi_record_n].priority = priority;
+    midi_record[midi_record_n].offset = midi_record_p;
+    midi_record[midi_record_n].count = count;
+    memcpy(&midi_record_bytes[midi_record_p], msg, count);
+    midi_record_n++;
+    midi_record_p += count;
+}
+
+void midi_record_start(void) {
+    midi_record_n = 0;
+    midi_record_p = 0;
+    midi_queue_observer = midi_record_observe;
+}
+
+int midi_record_count(void) {
+    return midi_record_n;
+}
+
+u16 midi_record_get(int i, u8 *priority, const u8 **msg) {
+    *priority = midi_record[i].priority;
+    *msg = &midi_record_bytes[midi_record[i].offset];
+    return midi_record[i].count;
+}
+
+void midi_record_dump(FILE *f, int from) {
+    int i;
+    u16 j;
+
+    for (i = from; i < midi_record_n; i++) {
+        fprintf(f, "MIDI[%s]:", midi_priority_names[midi_record[i].priority]);
+        for (j = 0; j < midi_record[i].count; j++) {
+            fprintf(f, " %02X", midi_record_bytes[midi_record[i].offset + j]);
+        }
+        fprintf(f, "\n");
+    }
+}
+#endif
 
 // Open UART0 device for MIDI communications and set baud rate to 31250 per MIDI standard:
 int midi_init(void) {
+#ifdef HWFEAT_MIDI_RECORD
+    midi_record_start();
+#endif
     return 0;
 }
 
@@ -14,7 +82,7 @@ void midi_send_cmd1_impl(u8 cmd_byte, u8 data1) {
     u8 buf[2];
     buf[0] = cmd_byte;
     buf[1] = data1;
-    fprintf(stderr, "MIDI: %02X %02X\n", cmd_byte, data1);
+    midi_queue_put(buf, 2);
 }
 
 void midi_send_cmd2_impl(u8 cmd_byte, u8 data1, u8 data2) {
@@ -22,17 +90,15 @@ void midi_send_cmd2_impl(u8 cmd_byte, u8 data1, u8 data2) {
     buf[0] = cmd_byte;
     buf[1] = data1;
     buf[2] = data2;
-    fprintf(stderr, "MIDI: %02X %02X %02X\n", cmd_byte, data1, data2);
+    midi_queue_put(buf, 3);
 }
 
-// 256 byte buffer for batching up SysEx data to send in one write() call:
+// 256 byte buffer for collecting a SysEx message before queueing it whole:
 u8 sysex[256];
 size_t sysex_p = 0;
 
 // Buffer up SysEx data until terminating F7 byte is encountered:
 void midi_send_sysex(u8 byte) {
-    //fprintf(stderr, "MIDI: %02X\n", byte);
-
     if (sysex_p >= 256) {
         fprintf(stderr, "MIDI SysEx data too large (>= 256 bytes)\n");
         return;
@@ -42,14 +108,179 @@ void midi_send_sysex(u8 byte) {
     sysex[sysex_p++] = byte;
 
     if (byte == 0xF7) {
-        size_t i;
-        size_t write_count = sysex_p;
+        midi_queue_put(sysex, (u16) sysex_p);
         sysex_p = 0;
+    }
+}
+
+// --------------- Simulated wire:
+
+COMPILE_ASSERT(MIDI_WIRE_TICK_BYTES >= MIDI_QUEUE_SIZE);
+
+struct midi_wire_tick midi_wire_tick;
+
+uint64_t midi_wire_worst_usec = 0;
+unsigned long midi_wire_total_bytes = 0;
+unsigned long midi_wire_total_ticks = 0;
 
-        fprintf(stderr, "MIDI SysEx:");
-        for (i = 0; i < write_count; i++) {
-            fprintf(stderr, " %02X", sysex[i]);
+uint64_t (*midi_wire_clock)(void) = NULL;
+void (*midi_wire_observer)(const struct midi_wire_tick *t) = NULL;
+bool midi_wire_log = true;
+
+// When the last byte put on the wire arrives:
+static uint64_t midi_wire_busy_until = 0;
+
+static uint64_t midi_now_usec(void) {
+    struct timespec ts;
+
+    if (midi_wire_clock != NULL) {
+        return midi_wire_clock();
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000ULL + (uint64_t) (ts.tv_nsec / 1000L);
+}
+
+void midi_wire_reset(void) {
+    midi_wire_busy_until = 0;
+    midi_wire_worst_usec = 0;
+    midi_wire_total_bytes = 0;
+    midi_wire_total_ticks = 0;
+    memset(&midi_wire_tick, 0, sizeof(midi_wire_tick));
+}
+
+uint64_t midi_wire_idle_at(void) {
+    return midi_wire_busy_until;
+}
+
+// Length of the encoded message at `data`, where `status` is the running status before it:
+static u16 midi_wire_msg_len(const u8 *data, u16 avail, u8 *status) {
+    u16 n;
+    u8 s = data[0];
+
+    if (s == 0xF0) {
+        for (n = 1; n < avail && data[n - 1] != 0xF7; n++);
+        *status = 0;
+        return n;
+    }
+
+    if (s & 0x80) {
+        if (s < 0xF0) {
+            *status = s;
+        } else if (s < 0xF8) {
+            *status = 0;
+        }
+        n = 1;
+    } else {
+        // Running status; data bytes only:
+        s = *status;
+        n = 0;
+    }
+
+    switch (s & 0xF0) {
+        case 0xC0:
+        case 0xD0:
+            n += 1;
+            break;
+        case 0x80:
+        case 0x90:
+        case 0xA0:
+        case 0xB0:
+        case 0xE0:
+            n += 2;
+            break;
+        default:
+            if (n == 0) n = 1;
+            break;
+    }
+
+    return n < avail ? n : avail;
+}
+
+// Put a tick's encoded bytes on the wire at `now` and time each message:
+static void midi_wire_send(const u8 *data, u16 len, uint64_t now) {
+    struct midi_wire_tick *t = &midi_wire_tick;
+    uint64_t at;
+    u16 i = 0;
+    u8 status = 0;
+
+    t->flush_usec = now;
+    t->start_usec = now > midi_wire_busy_until ? now : midi_wire_busy_until;
+    t->bytes = len;
+    t->count = 0;
+    memcpy(t->data, data, len);
+
+    at = t->start_usec;
+    while (i < len) {
+        u16 count = midi_wire_msg_len(&data[i], len - i, &status);
+
+        at += (uint64_t) count * MIDI_WIRE_BYTE_USEC;
+        if (t->count < MIDI_WIRE_TICK_MSGS) {
+            t->msgs[t->count].offset = i;
+            t->msgs[t->count].count = count;
+            t->msgs[t->count].arrive_usec = at;
+            t->count++;
+        }
+        i += count;
+    }
+
+    t->done_usec = at;
+    midi_wire_busy_until = at;
+
+    if (at - now > midi_wire_worst_usec) midi_wire_worst_usec = at - now;
+    midi_wire_total_bytes += len;
+    midi_wire_total_ticks++;
+}
+
+// Log when each message of the last tick arrives, relative to the flush:
+static void midi_wire_dump(void) {
+    const struct midi_wire_tick *t = &midi_wire_tick;
+    int m;
+    u16 j;
+
+    fprintf(stderr, "MIDI wire: %u bytes, start +%.2f ms, done +%.2f ms\n", t->bytes,
+            (t->start_usec - t->flush_usec) / 1000.0, (t->done_usec - t->flush_usec) / 1000.0);
+    for (m = 0; m < t->count; m++) {
+        fprintf(stderr, "  +%7.2f ms:", (t->msgs[m].arrive_usec - t->flush_usec) / 1000.0);
+        for (j = 0; j < t->msgs[m].count; j++) {
+            fprintf(stderr, " %02X", t->data[t->msgs[m].offset + j]);
         }
         fprintf(stderr, "\n");
     }
 }
+
+// Send MIDI messages queued during this tick over the simulated wire:
+void midi_flush(void) {
+    const u8 *data;
+    u16 len;
+    uint64_t now;
+#ifdef HWFEAT_MIDI_RECORD
+    int from = midi_record_count();
+#endif
+
+    if (midi_queue_len() == 0) return;
+
+    now = midi_now_usec();
+    len = midi_queue_encode(&data, (unsigned long) (now / 1000), MIDI_QUEUE_SIZE);
+    midi_wire_send(data, len, now);
+    if (midi_wire_log) {
+        midi_wire_dump();
+    }
+#ifdef HWFEAT_MIDI_RECORD
+    if (midi_record_log) {
+        midi_record_dump(stderr, from);
+    }
+#endif
+    latency_mark(LATENCY_MIDI_WRITE);
+
+    midi_queue_flushed(len, 0);
+
+    if (midi_wire_observer != NULL) {
+        midi_wire_observer(&midi_wire_tick);
+    }
+}
+
+void midi_stats(void) {
+    fprintf(stderr, "MIDI: %lu bytes in %lu ticks on the simulated wire; worst tick %.2f ms to last byte\n",
+            midi_wire_total_bytes, midi_wire_total_ticks, midi_wire_worst_usec / 1000.0);
+}
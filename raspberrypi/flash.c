@@ -1,13 +1,31 @@
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+
 #include "types.h"
 #include "hardware.h"
+#include "program-v5.h"
+#include "flash.h"
 
 // --------------- Flash memory functions:
 
-rom const u8 flash_bank[3][4096] = {
+// Size of the image: the set list followed by all 128 programs, rounded up to a whole 4 KB bank:
+#define FLASH_SIZE (((sizeof(struct set_list) + 128 * sizeof(struct program)) + 4095) & ~(size_t) 4095)
+
+// Image contents used to seed a new image file, or when no file can be mapped; banks past the
+// compiled-in ones hold undefined (zeroed) programs:
+rom const u8 flash_bank[FLASH_SIZE / 4096][4096] = {
     {
 #include "flash_v5_bank0.h"
     },
@@ -19,25 +37,480 @@ rom const u8 flash_bank[3][4096] = {
     }
 };
 
+/*
+    Stores are crash-safe:
+
+    The image file is mapped MAP_PRIVATE so edits never touch it directly. Each flash_store() is
+    applied to the mapping and appended to a journal file (flash_fname + ".journal") as a record
+    with a CRC32. The journal is replayed over the image at flash_init; replay stops at the first
+    torn or corrupt record.
+
+    flash_store() only copies into memory; a background thread writes and fdatasyncs the journal.
+    Once the journal grows past FLASH_JOURNAL_COMPACT bytes the thread writes the whole image to a
+    temporary file and renames it over the image, then starts a fresh journal holding only the
+    records stored since the snapshot. Replaying a record already in the image is harmless. The
+    directory is synced after each rename so the image always reaches disk before its new journal.
+
+    A journal starts with a header holding the CRC32 of the image it applies to. At flash_init a
+    journal whose CRC does not match the image file is discarded, so swapping in a new image while
+    the controller is stopped never replays old edits over it. If the image file is replaced while
+    running, compaction notices the file is no longer the one it wrote and leaves it alone; edits
+    made since are kept in the journal only until the next start, which discards them.
+*/
+
+// Image file in the same layout as the banks above:
+const char *flash_fname = "eminor3.flash";
+
+// Journal record header; followed by `count` data bytes and a CRC32 of header and data:
+struct flash_record {
+    uint32_t magic;
+    uint16_t addr;
+    uint16_t count;
+};
+
+#define FLASH_RECORD_MAGIC 0x314A4D45u  // "EMJ1"
+
+// Journal header; ties the records that follow to the image they were stored against:
+struct flash_journal_header {
+    uint32_t magic;
+    uint32_t image_crc;
+    // CRC32 of the two fields above:
+    uint32_t crc;
+};
+
+#define FLASH_JOURNAL_MAGIC 0x484A4D45u  // "EMJH"
+
+// Compact the journal into the image once it grows past this many bytes:
+#define FLASH_JOURNAL_COMPACT 16384
+
+// Records stored but not yet written to the journal:
+#define FLASH_PENDING_SIZE 8192
+
+// Mapped image, or the compiled-in banks before flash_init or if mapping failed:
+static u8 *flash_mem = (u8 *) flash_bank;
+static bool flash_mapped = false;
+
+static char flash_journal_fname[256];
+static char flash_tmp_fname[256];
+static int flash_journal_fd = -1;
+static size_t flash_journal_len = 0;
+
+// Image file last written or mapped; compaction stops if the file is replaced behind our back:
+static dev_t flash_image_dev;
+static ino_t flash_image_ino;
+static bool flash_image_replaced = false;
+
+// Seconds to wait before retrying a failed journal write:
+#define FLASH_RETRY_SECONDS 1
+
+// Guards flash_mem edits and the pending buffer between the controller and the journal thread:
+static pthread_mutex_t flash_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t flash_wake = PTHREAD_COND_INITIALIZER;
+static u8 flash_pending[FLASH_PENDING_SIZE];
+static size_t flash_pending_len = 0;
+static pthread_t flash_thread;
+
+// Journal statistics:
+unsigned long flash_journal_syncs = 0;
+unsigned long flash_journal_compactions = 0;
+// Stores refused because the journal thread was too far behind to take them:
+unsigned long flash_journal_overflows = 0;
+
+// Time from the oldest pending store to its fdatasync completing, last and worst (microseconds):
+unsigned long flash_sync_usec = 0;
+unsigned long flash_sync_usec_max = 0;
+static struct timespec flash_pending_since;
+
+static uint32_t flash_crc_table[256];
+
+static void flash_crc_init(void) {
+    uint32_t c;
+    int i, k;
+
+    for (i = 0; i < 256; i++) {
+        c = (uint32_t) i;
+        for (k = 0; k < 8; k++) {
+            c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        }
+        flash_crc_table[i] = c;
+    }
+}
+
+// CRC32 (IEEE) continuing from `crc`; start with 0:
+static uint32_t flash_crc32(uint32_t crc, const u8 *data, size_t len) {
+    crc = ~crc;
+    while (len--) {
+        crc = flash_crc_table[(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+// Write all of `len` bytes, retrying on EINTR and short writes:
+static int flash_write_all(int fd, const u8 *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        data += n;
+        len -= (size_t) n;
+    }
+    return 0;
+}
+
+// Atomically replace `fname` with `len` bytes at `data` by way of a synced temporary file:
+static int flash_replace_file(const char *fname, const u8 *data, size_t len) {
+    int fd;
+
+    fd = open(flash_tmp_fname, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        return -1;
+    }
+    if ((flash_write_all(fd, data, len) < 0) || (fsync(fd) < 0)) {
+        close(fd);
+        unlink(flash_tmp_fname);
+        return -1;
+    }
+    close(fd);
+
+    return rename(flash_tmp_fname, fname);
+}
+
+// Make renames in the image's directory durable:
+static int flash_dir_sync(void) {
+    char dir[256];
+    const char *slash = strrchr(flash_fname, '/');
+    int fd, retval;
+
+    if (slash == NULL) {
+        strcpy(dir, ".");
+    } else {
+        snprintf(dir, sizeof(dir), "%.*s", (int) (slash - flash_fname) + (slash == flash_fname), flash_fname);
+    }
+
+    fd = open(dir, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+    retval = fsync(fd);
+    close(fd);
+    return retval;
+}
+
+// Remember which file is the image now:
+static void flash_image_note(void) {
+    struct stat st;
+
+    if (stat(flash_fname, &st) == 0) {
+        flash_image_dev = st.st_dev;
+        flash_image_ino = st.st_ino;
+    }
+}
+
+// Returns true if the image file is still the one last written or mapped:
+static bool flash_image_ours(void) {
+    struct stat st;
+
+    if (stat(flash_fname, &st) != 0) {
+        return false;
+    }
+    return (st.st_dev == flash_image_dev) && (st.st_ino == flash_image_ino);
+}
+
+// Write a header binding the empty journal `fd` to an image with CRC `image_crc`, and sync it:
+static int flash_journal_start(int fd, uint32_t image_crc) {
+    struct flash_journal_header jh;
+
+    jh.magic = FLASH_JOURNAL_MAGIC;
+    jh.image_crc = image_crc;
+    jh.crc = flash_crc32(0, (const u8 *) &jh, offsetof(struct flash_journal_header, crc));
+    if ((flash_write_all(fd, (const u8 *) &jh, sizeof(jh)) < 0) || (fdatasync(fd) < 0)) {
+        return -1;
+    }
+    return 0;
+}
+
+// Apply journal records from offset `good` on over the image; returns the length of the valid
+// prefix of the journal:
+static size_t flash_replay(int fd, u8 *image, size_t good) {
+    struct flash_record hdr;
+    u8 data[65536 + 4];
+    unsigned records = 0;
+    uint32_t crc, stored;
+
+    for (;;) {
+        if (pread(fd, &hdr, sizeof(hdr), (off_t) good) != (ssize_t) sizeof(hdr)) break;
+        if (hdr.magic != FLASH_RECORD_MAGIC) break;
+        if ((size_t) hdr.addr + hdr.count > FLASH_SIZE) break;
+        if (pread(fd, data, hdr.count + 4u, (off_t) (good + sizeof(hdr))) != (ssize_t) (hdr.count + 4u)) break;
+
+        crc = flash_crc32(0, (const u8 *) &hdr, sizeof(hdr));
+        crc = flash_crc32(crc, data, hdr.count);
+        memcpy(&stored, &data[hdr.count], 4);
+        if (crc != stored) break;
+
+        memcpy(&image[hdr.addr], data, hdr.count);
+        good += sizeof(hdr) + hdr.count + 4u;
+        records++;
+    }
+
+    if (records > 0) {
+        fprintf(stderr, "flash: replayed %u journal records (%lu bytes)\n", records, (unsigned long) good);
+    }
+    return good;
+}
+
+// Snapshot the image into the image file and start a new journal with what was stored since:
+static void flash_compact(void) {
+    static u8 snapshot[FLASH_SIZE];
+    char journal_tmp[sizeof(flash_journal_fname) + 4];
+    int fd;
+
+    if (flash_image_replaced) return;
+
+    // Never write a snapshot of the old image over one swapped in while running:
+    if (!flash_image_ours()) {
+        fprintf(stderr, "flash: '%s' was replaced; not compacting, edits since start will not be kept\n", flash_fname);
+        flash_image_replaced = true;
+        return;
+    }
+
+    // Records stored after this copy (or still pending) go to the new journal:
+    pthread_mutex_lock(&flash_lock);
+    memcpy(snapshot, flash_mem, FLASH_SIZE);
+    pthread_mutex_unlock(&flash_lock);
+
+    // The image rename must be durable before the journal that depends on it replaces the old one:
+    if ((flash_replace_file(flash_fname, snapshot, FLASH_SIZE) < 0) || (flash_dir_sync() < 0)) {
+        perror("flash: compacting image");
+        return;
+    }
+    flash_image_note();
+
+    // The image now holds everything journaled so far; start an empty journal:
+    snprintf(journal_tmp, sizeof(journal_tmp), "%s.new", flash_journal_fname);
+    fd = open(journal_tmp, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        perror("flash: new journal");
+        return;
+    }
+    if ((flash_journal_start(fd, flash_crc32(0, snapshot, FLASH_SIZE)) < 0) ||
+        (rename(journal_tmp, flash_journal_fname) < 0) || (flash_dir_sync() < 0)) {
+        perror("flash: new journal");
+        close(fd);
+        unlink(journal_tmp);
+        return;
+    }
+
+    close(flash_journal_fd);
+    flash_journal_fd = fd;
+    flash_journal_len = sizeof(struct flash_journal_header);
+    flash_journal_compactions++;
+}
+
+// Background thread: writes pending records to the journal, syncs it, and compacts:
+static void *flash_journal_main(void *arg) {
+    static u8 batch[FLASH_PENDING_SIZE];
+    size_t len;
+    struct timespec since, now;
+
+    (void) arg;
+
+    for (;;) {
+        pthread_mutex_lock(&flash_lock);
+        while (flash_pending_len == 0) {
+            pthread_cond_wait(&flash_wake, &flash_lock);
+        }
+        len = flash_pending_len;
+        since = flash_pending_since;
+        memcpy(batch, flash_pending, len);
+        flash_pending_len = 0;
+        pthread_mutex_unlock(&flash_lock);
+
+        // Cut off anything a failed write left behind so later records are not stranded after it:
+        while ((flash_write_all(flash_journal_fd, batch, len) < 0) || (fdatasync(flash_journal_fd) < 0)) {
+            perror("flash: writing journal");
+            if (ftruncate(flash_journal_fd, (off_t) flash_journal_len) < 0) {
+                perror("flash: truncating journal");
+            }
+            sleep(FLASH_RETRY_SECONDS);
+        }
+        flash_journal_len += len;
+        flash_journal_syncs++;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        flash_sync_usec = (unsigned long) ((now.tv_sec - since.tv_sec) * 1000000L + (now.tv_nsec - since.tv_nsec) / 1000L);
+        if (flash_sync_usec > flash_sync_usec_max) {
+            flash_sync_usec_max = flash_sync_usec;
+        }
+
+        if (flash_journal_len >= FLASH_JOURNAL_COMPACT) {
+            flash_compact();
+        }
+    }
+
+    return NULL;
+}
+
+int flash_init(void) {
+    static u8 image[FLASH_SIZE];
+    struct stat st;
+    struct flash_journal_header jh;
+    void *mem;
+    int fd;
+    ssize_t have = 0, n;
+    size_t good;
+    uint32_t image_crc;
+    char err[300];
+
+    flash_crc_init();
+    snprintf(flash_journal_fname, sizeof(flash_journal_fname), "%s.journal", flash_fname);
+    snprintf(flash_tmp_fname, sizeof(flash_tmp_fname), "%s.tmp", flash_fname);
+
+    // Make sure a complete image file exists, seeding what is missing from the compiled-in banks:
+    memcpy(image, flash_bank, FLASH_SIZE);
+    fd = open(flash_fname, O_RDONLY | O_CLOEXEC);
+    if ((fd != -1) && (fstat(fd, &st) == 0) && ((size_t) st.st_size >= FLASH_SIZE)) {
+        // Complete image; use as is.
+    } else {
+        if (fd != -1) {
+            have = pread(fd, image, FLASH_SIZE, 0);
+            close(fd);
+        }
+        fprintf(stderr, "flash: %s '%s' from compiled-in programs\n", have > 0 ? "extending" : "creating", flash_fname);
+        if (flash_replace_file(flash_fname, image, FLASH_SIZE) < 0) {
+            sprintf(err, "write('%s')", flash_fname);
+            perror(err);
+            fprintf(stderr, "flash: using compiled-in programs; changes will not be saved\n");
+            return 0;
+        }
+        fd = open(flash_fname, O_RDONLY | O_CLOEXEC);
+    }
+    if (fd == -1) {
+        sprintf(err, "open('%s')", flash_fname);
+        perror(err);
+        return 21;
+    }
+
+    // Private mapping: edits live in memory and in the journal until compaction:
+    mem = mmap(NULL, FLASH_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED) {
+        perror("mmap() in flash_init");
+        return 23;
+    }
+    flash_mem = (u8 *) mem;
+    flash_image_note();
+    image_crc = flash_crc32(0, flash_mem, FLASH_SIZE);
+
+    flash_journal_fd = open(flash_journal_fname, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (flash_journal_fd == -1) {
+        sprintf(err, "open('%s')", flash_journal_fname);
+        perror(err);
+        return 24;
+    }
+
+    // Only replay a journal started against this image:
+    good = 0;
+    n = pread(flash_journal_fd, &jh, sizeof(jh), 0);
+    if ((n == (ssize_t) sizeof(jh)) && (jh.magic == FLASH_JOURNAL_MAGIC) &&
+        (jh.crc == flash_crc32(0, (const u8 *) &jh, offsetof(struct flash_journal_header, crc)))) {
+        if (jh.image_crc == image_crc) {
+            good = flash_replay(flash_journal_fd, flash_mem, sizeof(jh));
+        } else {
+            fprintf(stderr, "flash: '%s' belongs to a different image; discarding it\n", flash_journal_fname);
+        }
+    } else if (n > 0) {
+        fprintf(stderr, "flash: '%s' has no valid header; discarding it\n", flash_journal_fname);
+    }
+
+    // Drop any torn record at the end, or start a new journal:
+    if (good == 0) {
+        if ((ftruncate(flash_journal_fd, 0) < 0) || (flash_journal_start(flash_journal_fd, image_crc) < 0)) {
+            sprintf(err, "write('%s')", flash_journal_fname);
+            perror(err);
+            return 24;
+        }
+        good = sizeof(jh);
+    } else if ((fstat(flash_journal_fd, &st) == 0) && ((size_t) st.st_size > good)) {
+        fprintf(stderr, "flash: discarding %lu bytes of torn journal\n", (unsigned long) st.st_size - good);
+        if (ftruncate(flash_journal_fd, (off_t) good) < 0) {
+            perror("ftruncate() in flash_init");
+        }
+    }
+    flash_journal_len = good;
+
+    if ((errno = pthread_create(&flash_thread, NULL, flash_journal_main, NULL)) != 0) {
+        perror("pthread_create() in flash_init");
+        return 25;
+    }
+
+    flash_mapped = true;
+    return 0;
+}
+
 // Flash addresses are 0-based where 0 is the first available byte of
 // non-program flash memory.
 
 // Load `count` bytes from flash memory at address `addr` into `data`:
 void flash_load(u16 addr, u16 count, u8 *data) {
-    int bank = addr >> 12;
-    int offs = addr & 0x0FFF;
-    
-    memcpy((void *)data, (const void *)&flash_bank[bank][offs], (size_t)count);
+    if ((size_t) addr + count > FLASH_SIZE) {
+        fprintf(stderr, "flash: load of %u bytes at 0x%04X is out of range\n", count, addr);
+        memset(data, 0, count);
+        return;
+    }
+
+    memcpy((void *)data, (const void *)&flash_mem[addr], (size_t)count);
 }
 
-// Stores `count` bytes from `data` into flash memory at address `addr`:
-void flash_store(u16 addr, u16 count, u8 *data) {
+// Stores `count` bytes from `data` into flash memory at address `addr`; the journal thread makes it durable.
+// Never waits on the journal thread: a store it cannot take now is refused and changes nothing:
+int flash_store(u16 addr, u16 count, u8 *data) {
+    struct flash_record hdr;
+    size_t len = sizeof(hdr) + count + 4u;
+    uint32_t crc;
+
+    if (!flash_mapped) {
+        fprintf(stderr, "flash: not mapped; store of %u bytes at 0x%04X discarded\n", count, addr);
+        return -1;
+    }
+    if ((size_t) addr + count > FLASH_SIZE) {
+        fprintf(stderr, "flash: store of %u bytes at 0x%04X is out of range\n", count, addr);
+        return -1;
+    }
+
+    hdr.magic = FLASH_RECORD_MAGIC;
+    hdr.addr = addr;
+    hdr.count = count;
+    crc = flash_crc32(0, (const u8 *) &hdr, sizeof(hdr));
+    crc = flash_crc32(crc, data, count);
+
+    pthread_mutex_lock(&flash_lock);
+
+    // Journal thread is behind (e.g. retrying a failed write); leave flash as it was for the caller to retry:
+    if (flash_pending_len + len > FLASH_PENDING_SIZE) {
+        flash_journal_overflows++;
+        pthread_mutex_unlock(&flash_lock);
+        return -1;
+    }
+
+    memcpy(&flash_mem[addr], data, count);
+
+    if (flash_pending_len == 0) {
+        clock_gettime(CLOCK_MONOTONIC, &flash_pending_since);
+    }
+    memcpy(&flash_pending[flash_pending_len], &hdr, sizeof(hdr));
+    memcpy(&flash_pending[flash_pending_len + sizeof(hdr)], data, count);
+    memcpy(&flash_pending[flash_pending_len + sizeof(hdr) + count], &crc, 4);
+    flash_pending_len += len;
+
+    pthread_cond_signal(&flash_wake);
+    pthread_mutex_unlock(&flash_lock);
+    return 0;
 }
 
 // Get a pointer to flash memory at address:
 rom const u8 *flash_addr(u16 addr) {
-    int bank = addr >> 12;
-    int offs = addr & 0x0FFF;
-    
-    return (u8 *)flash_bank[bank] + offs;
+    return flash_mem + addr;
 }
@@ -0,0 +1,7 @@
+// Path of the program/setlist image file; created from the compiled-in banks if missing.
+// Stores are journaled to flash_fname + ".journal" and compacted back into the image:
+extern const char *flash_fname;
+
+// Map the image file and replay the journal; falls back to the compiled-in banks (read-only) if
+// the image cannot be created:
+int flash_init(void);
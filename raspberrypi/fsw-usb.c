@@ -6,6 +6,7 @@
 
 #include "types.h"
 #include "hardware.h"
+#include "latency.h"
 
 // Use USB PCsensor FootSwitch3-F1.8 as remote footswitch controller:
 // P:  Vendor=0c45 ProdID=7404 Rev=00.01
@@ -20,32 +21,23 @@ int fsw_fd = -1;
 u16 fsw_state = 0;
 
 int fsw_init(void) {
-    unsigned int rep[2];
-
     fsw_fd = open(fsw_evdev_name, O_RDONLY | O_NONBLOCK);
     if (fsw_fd < 0) {
         perror("open(" fsw_evdev_name ")");
         return 0;
     }
 
-    // Query repeat rate:
-    if (ioctl(fsw_fd, EVIOCGREP, rep) < 0) {
-        perror("ioctl EVIOCGREP");
-        return 0;
-    }
+    // Key auto-repeat events are ignored; the controller's gesture recognizer times holds and repeats.
 
-    // rep = {250, 33}. 250 is ms delay before repeat, 33 is ms repeat period.
-#if 0
-    fprintf(stderr, "rep = {%d, %d}\n", rep[0], rep[1]);
-#endif
-    rep[0] = 750;
-    rep[1] = 100;
-
-    // Set repeat rate:
-    if (ioctl(fsw_fd, EVIOCSREP, rep) < 0) {
-        perror("ioctl EVIOCSREP");
-        return -1;
+#ifdef HWFEAT_LATENCY
+    // Timestamp events with CLOCK_MONOTONIC so they can be compared with latency stages:
+    {
+        int clk = CLOCK_MONOTONIC;
+        if (ioctl(fsw_fd, EVIOCSCLOCKID, &clk) < 0) {
+            perror("ioctl EVIOCSCLOCKID");
+        }
     }
+#endif
 
     // Initialize fsw state:
     fsw_state = 0;
@@ -53,6 +45,10 @@ int fsw_init(void) {
     return 0;
 }
 
+int fsw_poll_fd(void) {
+    return fsw_fd;
+}
+
 u16 fsw_poll(void) {
     struct input_event ev;
     size_t size = sizeof(struct input_event);
@@ -62,9 +58,6 @@ u16 fsw_poll(void) {
         return 0;
     }
 
-    // Clear auto-repeat flags:
-    fsw_state &= ~((M_1 | M_2 | M_3) << 8u);
-
     // Check for event data since last read:
     while (read(fsw_fd, &ev, size) == size) {
 #if 0
@@ -74,6 +67,16 @@ u16 fsw_poll(void) {
 
         if (ev.type != EV_KEY) continue;
 
+#ifdef HWFEAT_LATENCY
+        // Use the kernel's timestamp of the press/release as the edge time:
+        if (ev.value != 2) {
+            struct timespec ts;
+            ts.tv_sec = ev.time.tv_sec;
+            ts.tv_nsec = ev.time.tv_usec * 1000L;
+            latency_edge_time(&ts);
+        }
+#endif
+
         switch (ev.code) {
             case 0x1E:
                 // Left:
@@ -81,9 +84,6 @@ u16 fsw_poll(void) {
                     fsw_state &= ~(M_1);
                 } else if (ev.value == 1) {
                     fsw_state |= (M_1);
-                } else if (ev.value == 2) {
-                    // auto-repeat:
-                    fsw_state |= (M_1 << 8u);
                 }
                 break;
             case 0x30:
@@ -92,9 +92,6 @@ u16 fsw_poll(void) {
                     fsw_state &= ~(M_2);
                 } else if (ev.value == 1) {
                     fsw_state |= (M_2);
-                } else if (ev.value == 2) {
-                    // auto-repeat:
-                    fsw_state |= (M_2 << 8u);
                 }
                 break;
             case 0x2E:
@@ -103,9 +100,6 @@ u16 fsw_poll(void) {
                     fsw_state &= ~(M_3);
                 } else if (ev.value == 1) {
                     fsw_state |= (M_3);
-                } else if (ev.value == 2) {
-                    // auto-repeat:
-                    fsw_state |= (M_3 << 8u);
                 }
                 break;
             default:
@@ -116,6 +110,14 @@ u16 fsw_poll(void) {
     return fsw_state;
 }
 
+#ifdef HWFEAT_FSW_EVENTS
+// Edges are not queued by this back end; the controller diffs fsw_poll() states instead:
+bool fsw_event_next(struct fsw_event *ev) {
+    (void) ev;
+    return false;
+}
+#endif
+
 int led_init(void) {
 }
 
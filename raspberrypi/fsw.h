@@ -1,2 +1,4 @@
-
 int fsw_init(void);
+
+// File descriptor that becomes readable on foot-switch input, or -1 if the device must be polled:
+int fsw_poll_fd(void);
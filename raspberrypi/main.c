@@ -5,6 +5,7 @@
 #include <fcntl.h>          //Used for UART
 #include <termios.h>        //Used for UART
 #include <time.h>
+#include <signal.h>
 
 #ifdef __linux
 #include <stdlib.h>
@@ -12,6 +13,10 @@
 #include <sys/ioctl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <errno.h>
 #endif
 
 #include "types.h"
@@ -20,6 +25,9 @@
 #include "fsw.h"
 #include "leds.h"
 #include "ux.h"
+#include "ux-socket.h"
+#include "flash.h"
+#include "latency.h"
 
 // Hardware interface from controller:
 void debug_log(const char *fmt, ...) {
@@ -40,14 +48,227 @@ void debug_log(const char *fmt, ...) {
 
 #endif
 
-// Main function:
-int main(void) {
-    int retval;
+#ifdef HWFEAT_WAKEUP_STATS
+
+// Count main loop wakeups and log the rate once per second:
+struct timespec wakeup_since;
+unsigned long wakeup_count = 0;
+
+static void wakeup_stats(void) {
+    struct timespec now;
+    long ms;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    wakeup_count++;
+
+    ms = (now.tv_sec - wakeup_since.tv_sec) * 1000L + (now.tv_nsec - wakeup_since.tv_nsec) / 1000000L;
+    if (ms >= 1000) {
+        fprintf(stderr, "main: %lu wakeups/sec\n", wakeup_count * 1000UL / (unsigned long) ms);
+        wakeup_count = 0;
+        wakeup_since = now;
+    }
+}
+
+#else
+#define wakeup_stats()
+#endif
+
+// Set by SIGUSR1; the main loop dumps statistics when it next wakes:
+static volatile sig_atomic_t stats_requested = 0;
+
+static void stats_sigusr1(int signal) {
+    (void) signal;
+    stats_requested = 1;
+}
+
+// Dump latency and MIDI back end statistics if SIGUSR1 was received since the last call:
+static void stats_poll(void) {
+    if (!stats_requested) return;
+    stats_requested = 0;
+
+    latency_dump();
+    midi_stats();
+}
+
+#if defined(__linux) && !defined(HWFEAT_SLEEP_LOOP)
+
+#define MAIN_MAX_EVENTS 8
+
+// Register `fd` to wake up the main loop when readable:
+static int main_watch_fd(int epfd, int fd) {
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        perror("epoll_ctl(EPOLL_CTL_ADD) in main_watch_fd");
+        return -1;
+    }
+
+    return 0;
+}
+
+// Event-driven main loop; sleeps until input arrives or the 10ms timer fires:
+static int main_loop(void) {
+    int epfd, tfd;
+    int fds[MAIN_MAX_EVENTS];
+    int nfds, i;
+    struct itimerspec its;
+    struct epoll_event events[MAIN_MAX_EVENTS];
+
+    if ((epfd = epoll_create1(0)) < 0) {
+        perror("epoll_create1");
+        return 11;
+    }
+
+    // Periodic 10ms timer drives controller_10msec_timer and polls devices without a file descriptor:
+    if ((tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK)) < 0) {
+        perror("timerfd_create");
+        return 11;
+    }
+    its.it_interval.tv_sec  = 0;
+    its.it_interval.tv_nsec = 10L * 1000000L;  // 10 ms
+    its.it_value = its.it_interval;
+    if (timerfd_settime(tfd, 0, &its, NULL) < 0) {
+        perror("timerfd_settime");
+        return 11;
+    }
+    if (main_watch_fd(epfd, tfd) < 0) {
+        return 11;
+    }
+
+    // Wake on foot-switch input:
+    if (fsw_poll_fd() >= 0) {
+        main_watch_fd(epfd, fsw_poll_fd());
+    }
+
+    // Wake on touchscreen and mouse input:
+    nfds = ux_poll_fds(fds, MAIN_MAX_EVENTS);
+    for (i = 0; i < nfds; i++) {
+        main_watch_fd(epfd, fds[i]);
+    }
+
+    // Wake when a redraw deferred by the UX frame rate cap is due:
+    if (ux_timer_fd() >= 0) {
+        main_watch_fd(epfd, ux_timer_fd());
+    }
+
+    // Wake when status socket clients connect, send commands or can take more output:
+    if (ux_socket_poll_fd() >= 0) {
+        main_watch_fd(epfd, ux_socket_poll_fd());
+    }
+
+    while (1) {
+        int n = epoll_wait(epfd, events, MAIN_MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                // Signals such as SIGUSR1 interrupt the wait:
+                stats_poll();
+                continue;
+            }
+            perror("epoll_wait");
+            return 12;
+        }
+
+        wakeup_stats();
+
+        for (i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+
+            if (fd == tfd) {
+                uint64_t expirations = 0;
+
+                // Run timer handler once per elapsed 10ms period:
+                if (read(tfd, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+                    while (expirations--) {
+                        controller_10msec_timer();
+                    }
+                }
+            } else if (events[i].events & (EPOLLHUP | EPOLLERR)) {
+                // Stop watching closed inputs (e.g. stdin at EOF) so we do not spin on them:
+                epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+            }
+        }
+
+        // Run controller code:
+        controller_handle();
+
+        // Send this tick's MIDI messages:
+        midi_flush();
+
+        // Poll for UX events:
+        ux_poll();
+
+        // Serve status socket clients:
+        ux_socket_poll();
+
+        // Redraw the screen if needed, after MIDI is out and no more often than ux_fps:
+        ux_draw();
+
+        // Send the latest report to status socket clients:
+        ux_socket_publish();
+
+        // Dump statistics if requested:
+        stats_poll();
+    }
+}
+
+#else
+
+// Fallback main loop for platforms without epoll; wakes every 1ms:
+static int main_loop(void) {
     struct timespec t;
+    int wakes = 0;
 
     t.tv_sec  = 0;
     t.tv_nsec = 1L * 1000000L;  // 1 ms
 
+    while (1) {
+        // Sleep:
+        while (nanosleep(&t, &t));
+
+        wakeup_stats();
+
+        // Run timer handler every 10th wake; it drives the 10ms gesture clock:
+        if (++wakes == 10) {
+            wakes = 0;
+            controller_10msec_timer();
+        }
+
+        // Run controller code:
+        controller_handle();
+
+        // Send this tick's MIDI messages:
+        midi_flush();
+
+        // Poll for UX events:
+        ux_poll();
+
+        // Serve status socket clients:
+        ux_socket_poll();
+
+        // Redraw the screen if needed, after MIDI is out and no more often than ux_fps:
+        ux_draw();
+
+        // Send the latest report to status socket clients:
+        ux_socket_publish();
+
+        // Dump statistics if requested:
+        stats_poll();
+    }
+}
+
+#endif
+
+// Main function:
+int main(void) {
+    int retval;
+
+    if ((retval = flash_init())) {
+        return retval;
+    }
+
     if ((retval = midi_init())) {
         return retval;
     }
@@ -64,23 +285,19 @@ int main(void) {
         return retval;
     }
 
+    if ((retval = ux_socket_init())) {
+        return retval;
+    }
+
     // Initialize controller:
     controller_init();
 
-    while (1) {
-        // Sleep:
-        while (nanosleep(&t, &t));
+    latency_init();
+    signal(SIGUSR1, stats_sigusr1);
 
-        // Run timer handler:
-        controller_10msec_timer();
-
-        // Run controller code:
-        controller_handle();
-
-        // Poll for UX events:
-        ux_poll();
+#ifdef HWFEAT_WAKEUP_STATS
+    clock_gettime(CLOCK_MONOTONIC, &wakeup_since);
+#endif
 
-        // Redraw the screen if needed:
-        ux_draw();
-    }
+    return main_loop();
 }
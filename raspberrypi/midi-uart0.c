@@ -1,10 +1,16 @@
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/eventfd.h>
 
 #define termios asmtermios
 #define termio asmtermio
@@ -17,6 +23,8 @@
 
 #include "types.h"
 #include "hardware.h"
+#include "latency.h"
+#include "midi-queue.h"
 
 // Global variable for holding file descriptor to talk to UART0 for MIDI communications:
 int uart0_fd = -1;
@@ -24,6 +32,100 @@ int uart0_fd = -1;
 // Default UART0 device name on Raspberry Pi Model B:
 const char *midi_fname = "/dev/ttyAMA0";
 
+// Bytes handed to the writer thread but not yet written to UART0; must be a power of two:
+#define MIDI_UART_RING_SIZE 1024
+
+// Keep at most this many bytes committed to the wire (ring plus UART output queue, about 40ms at
+// 31250 baud) so that values still waiting in the MIDI queue can be replaced by newer ones:
+#define MIDI_UART_COMMIT_MAX 128
+
+// Back off this long after an unexpected write error before retrying the same bytes:
+#define MIDI_UART_RETRY_MS 100
+
+// Single-producer (controller thread) / single-consumer (writer thread) byte ring. Indices only
+// ever increase; each side owns one of them and reads the other's with acquire ordering:
+static u8 midi_ring[MIDI_UART_RING_SIZE];
+static atomic_uint midi_ring_head = 0;
+static atomic_uint midi_ring_tail = 0;
+
+// eventfd the controller thread signals after adding bytes to the ring:
+static int midi_wake_fd = -1;
+static pthread_t midi_writer_thread;
+
+// Most bytes ever waiting in the ring, and counters from the writer thread:
+unsigned midi_uart_ring_high_water = 0;
+atomic_ulong midi_uart_bytes_written = 0;
+atomic_ulong midi_uart_eagain_waits = 0;
+atomic_ulong midi_uart_write_errors = 0;
+
+// Writer thread: drains the ring to UART0 in order, waiting for the device whenever it is full:
+static void *midi_writer(void *arg) {
+    (void) arg;
+
+    for (;;) {
+        unsigned tail = atomic_load_explicit(&midi_ring_tail, memory_order_relaxed);
+        unsigned head = atomic_load_explicit(&midi_ring_head, memory_order_acquire);
+        unsigned offset, len;
+        ssize_t count;
+        struct pollfd pfd;
+
+        if (head == tail) {
+            // Sleep until the controller thread queues more bytes:
+            uint64_t wakeups;
+
+            pfd.fd = midi_wake_fd;
+            pfd.events = POLLIN;
+            if (poll(&pfd, 1, -1) > 0) {
+                if (read(midi_wake_fd, &wakeups, sizeof(wakeups)) < 0 && errno != EAGAIN) {
+                    perror("read(midi_wake_fd)");
+                }
+            }
+            continue;
+        }
+
+        // Write the contiguous run up to the end of the ring; the wrapped part follows next pass:
+        offset = tail & (MIDI_UART_RING_SIZE - 1);
+        len = head - tail;
+        if (offset + len > MIDI_UART_RING_SIZE) {
+            len = MIDI_UART_RING_SIZE - offset;
+        }
+
+        count = write(uart0_fd, &midi_ring[offset], len);
+        if (count < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN) {
+                // Output buffer is full; wait until the device drains:
+                atomic_fetch_add_explicit(&midi_uart_eagain_waits, 1, memory_order_relaxed);
+                pfd.fd = uart0_fd;
+                pfd.events = POLLOUT;
+                poll(&pfd, 1, -1);
+                continue;
+            }
+
+            // Nothing was written, so keep the bytes and try again rather than drop them:
+            atomic_fetch_add_explicit(&midi_uart_write_errors, 1, memory_order_relaxed);
+            perror("Error sending MIDI bytes");
+            poll(NULL, 0, MIDI_UART_RETRY_MS);
+            continue;
+        }
+
+        // Partial writes continue with the remainder:
+        atomic_fetch_add_explicit(&midi_uart_bytes_written, (unsigned long) count, memory_order_relaxed);
+        atomic_store_explicit(&midi_ring_tail, tail + (unsigned) count, memory_order_release);
+    }
+
+    return NULL;
+}
+
+// Log ring sizing statistics; at exit and on SIGUSR1:
+void midi_stats(void) {
+    fprintf(stderr, "MIDI: ring high-water %u of %u bytes; %lu bytes written, %lu EAGAIN waits, %lu write errors\n",
+            midi_uart_ring_high_water, MIDI_UART_RING_SIZE,
+            atomic_load(&midi_uart_bytes_written),
+            atomic_load(&midi_uart_eagain_waits),
+            atomic_load(&midi_uart_write_errors));
+}
+
 // Open UART0 device for MIDI communications and set baud rate to 31250 per MIDI standard:
 int midi_init(void) {
 #ifdef __linux
@@ -63,44 +165,42 @@ int midi_init(void) {
     ioctl(uart0_fd, TCSETS2, &tio);
 #endif
 
+    // Start the writer thread so the controller thread never blocks on the UART:
+    midi_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (midi_wake_fd == -1) {
+        perror("eventfd() in midi_init");
+        return 2;
+    }
+    if ((errno = pthread_create(&midi_writer_thread, NULL, midi_writer, NULL)) != 0) {
+        perror("pthread_create() in midi_init");
+        return 3;
+    }
+    atexit(midi_stats);
+
     return 0;
 }
 
 void midi_send_cmd1_impl(u8 cmd_byte, u8 data1) {
-    ssize_t count;
     u8 buf[2];
     buf[0] = cmd_byte;
     buf[1] = data1;
-    count = write(uart0_fd, buf, 2);
-    if (count != 2) {
-        perror("Error sending MIDI bytes");
-        return;
-    }
-    fprintf(stderr, "MIDI: %02X %02X\n", cmd_byte, data1);
+    midi_queue_put(buf, 2);
 }
 
 void midi_send_cmd2_impl(u8 cmd_byte, u8 data1, u8 data2) {
-    ssize_t count;
     u8 buf[3];
     buf[0] = cmd_byte;
     buf[1] = data1;
     buf[2] = data2;
-    count = write(uart0_fd, buf, 3);
-    if (count != 3) {
-        perror("Error sending MIDI bytes");
-        return;
-    }
-    fprintf(stderr, "MIDI: %02X %02X %02X\n", cmd_byte, data1, data2);
+    midi_queue_put(buf, 3);
 }
 
-// 256 byte buffer for batching up SysEx data to send in one write() call:
+// 256 byte buffer for collecting a SysEx message before queueing it whole:
 u8 sysex[256];
 size_t sysex_p = 0;
 
 // Buffer up SysEx data until terminating F7 byte is encountered:
 void midi_send_sysex(u8 byte) {
-    //fprintf(stderr, "MIDI: %02X\n", byte);
-
     if (sysex_p >= 256) {
         fprintf(stderr, "MIDI SysEx data too large (>= 256 bytes)\n");
         return;
@@ -110,24 +210,62 @@ void midi_send_sysex(u8 byte) {
     sysex[sysex_p++] = byte;
 
     if (byte == 0xF7) {
-        size_t i;
-        size_t write_count = sysex_p;
+        midi_queue_put(sysex, (u16) sysex_p);
         sysex_p = 0;
+    }
+}
 
-        fprintf(stderr, "MIDI SysEx:");
-        for (i = 0; i < write_count; i++) {
-            fprintf(stderr, " %02X", sysex[i]);
-        }
-        fprintf(stderr, "\n");
+// Hand MIDI messages queued so far to the writer thread; never blocks:
+void midi_flush(void) {
+    const u8 *data;
+    u16 len, budget;
+    unsigned head, tail, used, offset, first;
+    uint64_t wakeup = 1;
+    int outq = 0;
 
-        ssize_t count = write(uart0_fd, sysex, write_count);
-        if (count < 0) {
-            perror("write in midi_send_sysex");
-            return;
-        }
-        if (count != write_count) {
-            fprintf(stderr, "midi_send_sysex write didnt write enough bytes\n");
-            return;
-        }
+    if (midi_queue_len() == 0) return;
+
+    head = atomic_load_explicit(&midi_ring_head, memory_order_relaxed);
+    tail = atomic_load_explicit(&midi_ring_tail, memory_order_acquire);
+    used = head - tail;
+
+    // Only commit what the UART can send soon; the rest waits in the queue for the next tick:
+    if (ioctl(uart0_fd, TIOCOUTQ, &outq) < 0) {
+        outq = 0;
+    }
+    if (used + (unsigned) outq == 0) {
+        // Wire is idle; let a message longer than the commit limit (e.g. SysEx) through whole:
+        budget = MIDI_UART_RING_SIZE;
+    } else if (used + (unsigned) outq < MIDI_UART_COMMIT_MAX) {
+        budget = (u16) (MIDI_UART_COMMIT_MAX - (used + (unsigned) outq));
+    } else {
+        return;
+    }
+
+    len = midi_queue_encode(&data, midi_queue_now_ms(), budget);
+    if (len == 0) return;
+    midi_queue_log(data, len);
+
+    // Copy into the ring, wrapping at the end:
+    offset = head & (MIDI_UART_RING_SIZE - 1);
+    first = len;
+    if (offset + first > MIDI_UART_RING_SIZE) {
+        first = MIDI_UART_RING_SIZE - offset;
     }
+    memcpy(&midi_ring[offset], data, first);
+    memcpy(midi_ring, data + first, len - first);
+    atomic_store_explicit(&midi_ring_head, head + len, memory_order_release);
+
+    if (used + len > midi_uart_ring_high_water) {
+        midi_uart_ring_high_water = used + len;
+    }
+
+    // The writer thread finishes the bytes; this marks their hand-off:
+    latency_mark(LATENCY_MIDI_WRITE);
+
+    if (write(midi_wake_fd, &wakeup, sizeof(wakeup)) < 0) {
+        perror("write(midi_wake_fd)");
+    }
+
+    midi_queue_flushed(len, 1);
 }
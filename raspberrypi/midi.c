@@ -5,11 +5,14 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <poll.h>
 
 #include <sys/ioctl.h>
 
 #include "types.h"
 #include "hardware.h"
+#include "latency.h"
+#include "midi-queue.h"
 
 // Global variable for holding file descriptor to talk to MIDI communications:
 int midi_fd = -1;
@@ -33,40 +36,26 @@ int midi_init(void) {
 }
 
 void midi_send_cmd1_impl(u8 cmd_byte, u8 data1) {
-    ssize_t count;
     u8 buf[2];
     buf[0] = cmd_byte;
     buf[1] = data1;
-    count = write(midi_fd, buf, 2);
-    if (count != 2) {
-        perror("Error sending MIDI bytes");
-        return;
-    }
-    fprintf(stderr, "MIDI: %02X %02X\n", cmd_byte, data1);
+    midi_queue_put(buf, 2);
 }
 
 void midi_send_cmd2_impl(u8 cmd_byte, u8 data1, u8 data2) {
-    ssize_t count;
     u8 buf[3];
     buf[0] = cmd_byte;
     buf[1] = data1;
     buf[2] = data2;
-    count = write(midi_fd, buf, 3);
-    if (count != 3) {
-        perror("Error sending MIDI bytes");
-        return;
-    }
-    fprintf(stderr, "MIDI: %02X %02X %02X\n", cmd_byte, data1, data2);
+    midi_queue_put(buf, 3);
 }
 
-// 256 byte buffer for batching up SysEx data to send in one write() call:
+// 256 byte buffer for collecting a SysEx message before queueing it whole:
 u8 sysex[256];
 size_t sysex_p = 0;
 
 // Buffer up SysEx data until terminating F7 byte is encountered:
 void midi_send_sysex(u8 byte) {
-    //fprintf(stderr, "MIDI: %02X\n", byte);
-
     if (sysex_p >= 256) {
         fprintf(stderr, "MIDI SysEx data too large (>= 256 bytes)\n");
         return;
@@ -76,24 +65,53 @@ void midi_send_sysex(u8 byte) {
     sysex[sysex_p++] = byte;
 
     if (byte == 0xF7) {
-        size_t i;
-        size_t write_count = sysex_p;
+        midi_queue_put(sysex, (u16) sysex_p);
         sysex_p = 0;
+    }
+}
 
-        fprintf(stderr, "MIDI SysEx:");
-        for (i = 0; i < write_count; i++) {
-            fprintf(stderr, " %02X", sysex[i]);
-        }
-        fprintf(stderr, "\n");
+// Write all MIDI messages queued so far in as few write() calls as possible:
+void midi_flush(void) {
+    const u8 *data;
+    u16 len;
+    u16 written = 0;
+    u16 syscalls = 0;
 
-        ssize_t count = write(midi_fd, sysex, write_count);
+    if (midi_queue_len() == 0) return;
+
+    len = midi_queue_encode(&data, midi_queue_now_ms(), MIDI_QUEUE_SIZE);
+    midi_queue_log(data, len);
+
+    while (written < len) {
+        ssize_t count = write(midi_fd, data + written, len - written);
+        syscalls++;
         if (count < 0) {
-            perror("write in midi_send_sysex");
-            return;
-        }
-        if (count != write_count) {
-            fprintf(stderr, "midi_send_sysex write didnt write enough bytes\n");
-            return;
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN) {
+                // Output buffer is full; wait until the device drains:
+                struct pollfd pfd;
+                pfd.fd = midi_fd;
+                pfd.events = POLLOUT;
+                poll(&pfd, 1, -1);
+                continue;
+            }
+            perror("Error sending MIDI bytes");
+            // Receiver may have missed a status byte:
+            midi_queue_reset_status();
+            break;
         }
+        // Partial writes continue with the remainder:
+        written += (u16) count;
+    }
+    if (written > 0) {
+        latency_mark(LATENCY_MIDI_WRITE);
     }
+
+    midi_queue_flushed(written, syscalls);
+}
+
+void midi_stats(void) {
+    fprintf(stderr, "MIDI: %lu bytes in %lu ticks, %lu write calls; worst tick %u bytes; running status saved %lu bytes\n",
+            midi_tick.total_bytes, midi_tick.total_ticks, midi_tick.total_syscalls,
+            midi_tick.max_bytes, midi_tick.total_saved);
 }
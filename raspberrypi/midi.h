@@ -1,2 +1,8 @@
 
 int midi_init(void);
+
+// Write MIDI messages queued so far; back ends may keep some queued until the wire has room:
+void midi_flush(void);
+
+// Log the back end's output statistics to stderr (on SIGUSR1):
+void midi_stats(void);
@@ -1,9 +1,13 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <time.h>
 
 #include <unistd.h>
 #include <sys/ioctl.h>
+#include <linux/gpio.h>
 
 #include <linux/i2c-dev.h>
 // Terrible portability hack between arm-linux-gnueabihf-gcc on Mac OS X and native gcc on raspbian.
@@ -11,6 +15,11 @@
 #include <linux/i2c.h>
 # endif
 
+// This back end queues timestamped edges; the controller must be built to consume them:
+#ifndef HWFEAT_FSW_EVENTS
+#error "sx1509-fsw-leds.c requires HWFEAT_FSW_EVENTS (cmake -DHWFEAT_FSW_SX1509=ON or make FSW=sx1509)"
+#endif
+
 #include "types.h"
 #include "hardware.h"
 
@@ -21,20 +30,81 @@
 // ADD1 = 1, ADD0 = 0
 #define i2c_sx1509_led_addr 0x70
 
+// The button SX1509's open-drain NINT output is wired to this GPIO line (BCM GPIO17, header pin 11)
+// with the Pi's pull-up; if it cannot be opened the switches are polled every tick instead:
+const char *fsw_gpio_chip = "/dev/gpiochip0";
+int fsw_gpio_line = 17;
+
+// SX1509 RegDebounceConfig: debounce time is 0.5ms << value with the 2MHz internal oscillator:
+#define FSW_DEBOUNCE_CONFIG 3
+
+// Queued foot-switch edges; the oldest is overwritten when full:
+#define FSW_EVENT_QUEUE_SIZE 32
+
 int i2c_init(void);
 void i2c_close(void);
 
 int i2c_write(u8 slave_addr, u8 reg, u8 data);
 int i2c_read(u8 slave_addr, u8 reg, u8 *result);
+int i2c_write_burst(u8 slave_addr, u8 reg, const u8 *data, u16 count);
+int i2c_read_burst(u8 slave_addr, u8 reg, u8 *result, u16 count);
 
 typedef u8 byte;
 #include "sx1509_registers.h"
 
+// Largest burst write (register address + data):
+#define I2C_BURST_MAX 16
+
 // Global file descriptor used to talk to the I2C bus:
 int i2c_fd = -1;
 // Default RPi B device name for the I2C bus exposed on GPIO2,3 pins (GPIO2=SDA, GPIO3=SCL):
 const char *i2c_fname = "/dev/i2c-1";
 
+// I2C_RDWR transactions and time spent in them; a tick starts at each fsw_poll():
+struct i2c_tick_stats {
+    // transactions and microseconds for the last tick that used the bus:
+    u16 transactions;
+    unsigned long usec;
+
+    // worst tick seen:
+    u16 max_transactions;
+    unsigned long max_usec;
+
+    // totals since start:
+    unsigned long total_transactions;
+    unsigned long total_usec;
+    unsigned long total_ticks;
+};
+
+struct i2c_tick_stats i2c_tick;
+static u16 i2c_tick_transactions = 0;
+static unsigned long i2c_tick_usec = 0;
+
+// Close out the current tick's I2C counters:
+static void i2c_tick_end(void) {
+    i2c_tick.total_ticks++;
+    if (i2c_tick_transactions == 0) {
+        return;
+    }
+
+    i2c_tick.transactions = i2c_tick_transactions;
+    i2c_tick.usec = i2c_tick_usec;
+    if (i2c_tick_transactions > i2c_tick.max_transactions) i2c_tick.max_transactions = i2c_tick_transactions;
+    if (i2c_tick_usec > i2c_tick.max_usec) i2c_tick.max_usec = i2c_tick_usec;
+    i2c_tick.total_transactions += i2c_tick_transactions;
+    i2c_tick.total_usec += i2c_tick_usec;
+
+    i2c_tick_transactions = 0;
+    i2c_tick_usec = 0;
+}
+
+static void i2c_stats(void) {
+    i2c_tick_end();
+    fprintf(stderr, "i2c: %lu ticks, %lu transactions, %lu usec; worst tick %u transactions, %lu usec\n",
+            i2c_tick.total_ticks, i2c_tick.total_transactions, i2c_tick.total_usec,
+            i2c_tick.max_transactions, i2c_tick.max_usec);
+}
+
 // Returns a new file descriptor for communicating with the I2C bus:
 int i2c_init(void) {
     if ((i2c_fd = open(i2c_fname, O_RDWR)) < 0) {
@@ -50,6 +120,8 @@ int i2c_init(void) {
     // or read() syscalls with an I2C device which does not support SMBUS protocol. I2C_RDWR is much better especially
     // for reading device registers which requires a write first before reading the response.
 
+    atexit(i2c_stats);
+
     return i2c_fd;
 }
 
@@ -57,39 +129,57 @@ void i2c_close(void) {
     close(i2c_fd);
 }
 
-// Write to an I2C slave device's register:
-int i2c_write(u8 slave_addr, u8 reg, u8 data) {
+// Run one I2C_RDWR transaction and account for it:
+static int i2c_transfer(struct i2c_msg *msgs, int nmsgs, const char *caller) {
+    struct i2c_rdwr_ioctl_data msgset[1];
+    struct timespec t0, t1;
     int retval;
-    u8 outbuf[2];
 
+    msgset[0].msgs = msgs;
+    msgset[0].nmsgs = nmsgs;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    retval = ioctl(i2c_fd, I2C_RDWR, &msgset);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    i2c_tick_transactions++;
+    i2c_tick_usec += (unsigned long) ((t1.tv_sec - t0.tv_sec) * 1000000L + (t1.tv_nsec - t0.tv_nsec) / 1000L);
+
+    if (retval < 0) {
+        char err[64];
+        sprintf(err, "ioctl(I2C_RDWR) in %s", caller);
+        perror(err);
+        return -1;
+    }
+
+    return 0;
+}
+
+// Write `count` consecutive registers starting at `reg` in one transaction (SX1509 auto-increments):
+int i2c_write_burst(u8 slave_addr, u8 reg, const u8 *data, u16 count) {
+    u8 outbuf[I2C_BURST_MAX + 1];
     struct i2c_msg msgs[1];
-    struct i2c_rdwr_ioctl_data msgset[1];
+
+    if (count > I2C_BURST_MAX) {
+        fprintf(stderr, "i2c_write_burst: %u bytes is more than %u\n", count, I2C_BURST_MAX);
+        return -1;
+    }
 
     outbuf[0] = reg;
-    outbuf[1] = data;
+    memcpy(&outbuf[1], data, count);
 
     msgs[0].addr = slave_addr;
     msgs[0].flags = 0;
-    msgs[0].len = 2;
+    msgs[0].len = (u16) (count + 1);
     msgs[0].buf = outbuf;
 
-    msgset[0].msgs = msgs;
-    msgset[0].nmsgs = 1;
-
-    if (ioctl(i2c_fd, I2C_RDWR, &msgset) < 0) {
-        perror("ioctl(I2C_RDWR) in i2c_write");
-        return -1;
-    }
-
-    return 0;
+    return i2c_transfer(msgs, 1, "i2c_write_burst");
 }
 
-// Read the given I2C slave device's register and return the read value in `*result`:
-int i2c_read(u8 slave_addr, u8 reg, u8 *result) {
-    int retval;
-    u8 outbuf[1], inbuf[1];
+// Read `count` consecutive registers starting at `reg` in one combined write-read transaction:
+int i2c_read_burst(u8 slave_addr, u8 reg, u8 *result, u16 count) {
+    u8 outbuf[1];
     struct i2c_msg msgs[2];
-    struct i2c_rdwr_ioctl_data msgset[1];
 
     msgs[0].addr = slave_addr;
     msgs[0].flags = 0;
@@ -98,24 +188,100 @@ int i2c_read(u8 slave_addr, u8 reg, u8 *result) {
 
     msgs[1].addr = slave_addr;
     msgs[1].flags = I2C_M_RD | I2C_M_NOSTART;
-    msgs[1].len = 1;
-    msgs[1].buf = inbuf;
-
-    msgset[0].msgs = msgs;
-    msgset[0].nmsgs = 2;
+    msgs[1].len = count;
+    msgs[1].buf = result;
 
     outbuf[0] = reg;
 
-    inbuf[0] = 0;
+    memset(result, 0, count);
+    return i2c_transfer(msgs, 2, "i2c_read_burst");
+}
+
+// Write to an I2C slave device's register:
+int i2c_write(u8 slave_addr, u8 reg, u8 data) {
+    return i2c_write_burst(slave_addr, reg, &data, 1);
+}
+
+// Read the given I2C slave device's register and return the read value in `*result`:
+int i2c_read(u8 slave_addr, u8 reg, u8 *result) {
+    return i2c_read_burst(slave_addr, reg, result, 1);
+}
+
+// Write a 16-bit value to a B/A register pair (bank B is the high byte at the lower address):
+static int sx1509_write16(u8 slave_addr, u8 reg_b, u16 value) {
+    u8 buf[2];
+
+    buf[0] = (u8) (value >> 8);
+    buf[1] = (u8) (value & 0xFF);
+    return i2c_write_burst(slave_addr, reg_b, buf, 2);
+}
+
+// GPIO line event fd for the SX1509 interrupt line, or -1 to poll:
+int fsw_irq_fd = -1;
+
+// Debounced switch state as of the last read:
+u16 fsw_state = 0;
 
-    *result = 0;
-    if (ioctl(i2c_fd, I2C_RDWR, &msgset) < 0) {
-        perror("ioctl(I2C_RDWR) in i2c_read");
+struct fsw_event fsw_events[FSW_EVENT_QUEUE_SIZE];
+unsigned fsw_events_head = 0, fsw_events_tail = 0;
+unsigned long fsw_events_overflow = 0;
+
+// Interrupts serviced and I2C reads they caused:
+unsigned long fsw_irq_count = 0;
+unsigned long fsw_reads = 0;
+
+static void fsw_event_put(u16 fsw, bool pressed, const struct timespec *ts) {
+    if (fsw_events_head - fsw_events_tail == FSW_EVENT_QUEUE_SIZE) {
+        fsw_events_tail++;
+        fsw_events_overflow++;
+    }
+
+    struct fsw_event *ev = &fsw_events[fsw_events_head % FSW_EVENT_QUEUE_SIZE];
+    ev->fsw = fsw;
+    ev->pressed = pressed;
+    ev->ts = *ts;
+    fsw_events_head++;
+}
+
+bool fsw_event_next(struct fsw_event *ev) {
+    if (fsw_events_tail == fsw_events_head) {
+        return false;
+    }
+
+    *ev = fsw_events[fsw_events_tail % FSW_EVENT_QUEUE_SIZE];
+    fsw_events_tail++;
+    return true;
+}
+
+static void fsw_poll_state(void);
+
+// Request falling-edge events on the SX1509 NINT line:
+static int fsw_irq_init(void) {
+    struct gpioevent_request req;
+    int chip_fd;
+
+    if ((chip_fd = open(fsw_gpio_chip, O_RDONLY)) < 0) {
+        char err[200];
+        sprintf(err, "open('%s') in fsw_irq_init", fsw_gpio_chip);
+        perror(err);
         return -1;
     }
 
-    *result = inbuf[0];
-    return 0;
+    memset(&req, 0, sizeof(req));
+    req.lineoffset = (unsigned) fsw_gpio_line;
+    req.handleflags = GPIOHANDLE_REQUEST_INPUT;
+    req.eventflags = GPIOEVENT_REQUEST_FALLING_EDGE;
+    strncpy(req.consumer_label, "eminor3-fsw", sizeof(req.consumer_label) - 1);
+
+    if (ioctl(chip_fd, GPIO_GET_LINEEVENT_IOCTL, &req) < 0) {
+        perror("ioctl(GPIO_GET_LINEEVENT_IOCTL) in fsw_irq_init");
+        close(chip_fd);
+        return -1;
+    }
+    close(chip_fd);
+
+    fcntl(req.fd, F_SETFL, fcntl(req.fd, F_GETFL) | O_NONBLOCK);
+    return req.fd;
 }
 
 // Initialize SX1509 for buttons by enabling all pins as inputs and pull-up resistors:
@@ -128,16 +294,40 @@ int fsw_init(void) {
     }
 
     // Set all pins as inputs:
-    if (i2c_write(i2c_sx1509_btn_addr, REG_DIR_A,           0xFF) != 0) goto fail;
-    if (i2c_write(i2c_sx1509_btn_addr, REG_DIR_B,           0xFF) != 0) goto fail;
-    if (i2c_write(i2c_sx1509_btn_addr, REG_INPUT_DISABLE_A, 0x00) != 0) goto fail;
-    if (i2c_write(i2c_sx1509_btn_addr, REG_INPUT_DISABLE_B, 0x00) != 0) goto fail;
+    if (sx1509_write16(i2c_sx1509_btn_addr, REG_DIR_B,           0xFFFF) != 0) goto fail;
+    if (sx1509_write16(i2c_sx1509_btn_addr, REG_INPUT_DISABLE_B, 0x0000) != 0) goto fail;
+
+    // Pull-up resistor on all pins for active-low buttons (RegPullUpB..RegPullDownA):
+    {
+        const u8 pulls[4] = {0xFF, 0xFF, 0x00, 0x00};
+        if (i2c_write_burst(i2c_sx1509_btn_addr, REG_PULL_UP_B, pulls, 4) != 0) goto fail;
+    }
+
+    // Debounce needs the internal 2MHz oscillator:
+    if (i2c_write(i2c_sx1509_btn_addr, REG_CLOCK, 0x40) != 0) goto fail;
+    {
+        // RegDebounceConfig, RegDebounceEnableB, RegDebounceEnableA:
+        const u8 debounce[3] = {FSW_DEBOUNCE_CONFIG, 0xFF, 0xFF};
+        if (i2c_write_burst(i2c_sx1509_btn_addr, REG_DEBOUNCE_CONFIG, debounce, 3) != 0) goto fail;
+    }
+
+    // Interrupt on both edges of every pin and clear stale sources (RegSenseHighB..RegInterruptSourceA);
+    // NINT clears when RegData is read (RegMisc default):
+    {
+        const u8 sense[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+        if (i2c_write_burst(i2c_sx1509_btn_addr, REG_SENSE_HIGH_B, sense, 6) != 0) goto fail;
+    }
+    if (sx1509_write16(i2c_sx1509_btn_addr, REG_INTERRUPT_MASK_B, 0x0000) != 0) goto fail;
 
-    // Pull-up resistor on all pins for active-low buttons:
-    if (i2c_write(i2c_sx1509_btn_addr, REG_PULL_UP_A,   0xFF) != 0) goto fail;
-    if (i2c_write(i2c_sx1509_btn_addr, REG_PULL_UP_B,   0xFF) != 0) goto fail;
-    if (i2c_write(i2c_sx1509_btn_addr, REG_PULL_DOWN_A, 0x00) != 0) goto fail;
-    if (i2c_write(i2c_sx1509_btn_addr, REG_PULL_DOWN_B, 0x00) != 0) goto fail;
+    fsw_irq_fd = fsw_irq_init();
+    if (fsw_irq_fd < 0) {
+        fprintf(stderr, "fsw: no SX1509 interrupt line; polling foot-switches\n");
+    }
+
+    // Read initial state, which also releases NINT:
+    fsw_state = 0;
+    fsw_poll_state();
+    fsw_events_tail = fsw_events_head;
 
     return 0;
 
@@ -155,16 +345,14 @@ int led_init(void) {
     }
 
     // Set all pins as outputs for LEDs:
-    if (i2c_write(i2c_sx1509_led_addr, REG_DIR_A,           0x00) != 0) goto fail;
-    if (i2c_write(i2c_sx1509_led_addr, REG_DIR_B,           0x00) != 0) goto fail;
-    if (i2c_write(i2c_sx1509_led_addr, REG_INPUT_DISABLE_A, 0xFF) != 0) goto fail;
-    if (i2c_write(i2c_sx1509_led_addr, REG_INPUT_DISABLE_B, 0xFF) != 0) goto fail;
+    if (sx1509_write16(i2c_sx1509_led_addr, REG_DIR_B,           0x0000) != 0) goto fail;
+    if (sx1509_write16(i2c_sx1509_led_addr, REG_INPUT_DISABLE_B, 0xFFFF) != 0) goto fail;
 
-    // No pull-up or pull-down resistors on LED pins:
-    if (i2c_write(i2c_sx1509_led_addr, REG_PULL_UP_A,   0x00) != 0) goto fail;
-    if (i2c_write(i2c_sx1509_led_addr, REG_PULL_UP_B,   0x00) != 0) goto fail;
-    if (i2c_write(i2c_sx1509_led_addr, REG_PULL_DOWN_A, 0x00) != 0) goto fail;
-    if (i2c_write(i2c_sx1509_led_addr, REG_PULL_DOWN_B, 0x00) != 0) goto fail;
+    // No pull-up or pull-down resistors on LED pins (RegPullUpB..RegPullDownA):
+    {
+        const u8 pulls[4] = {0x00, 0x00, 0x00, 0x00};
+        if (i2c_write_burst(i2c_sx1509_led_addr, REG_PULL_UP_B, pulls, 4) != 0) goto fail;
+    }
 
     return 0;
 
@@ -172,23 +360,91 @@ int led_init(void) {
     return 3;
 }
 
-// Poll 16 foot-switch states:
-u16 fsw_poll(void) {
+// Readable when the SX1509 signals a debounced switch change; -1 if it must be polled:
+int fsw_poll_fd(void) {
+    return fsw_irq_fd;
+}
+
+// Read the debounced switch state and queue an event per changed switch, stamped `ts`:
+static void fsw_read_state(const struct timespec *ts) {
     u8 buf[2];
-    // Read both data registers to get entire 16 bits of input state:
-    if (i2c_read(i2c_sx1509_btn_addr, REG_DATA_A, &buf[0]) != 0) return 0;
-    if (i2c_read(i2c_sx1509_btn_addr, REG_DATA_B, &buf[1]) != 0) return 0;
+    u16 state, changed, m;
+
+    // Read RegDataB and RegDataA in one transaction to get entire 16 bits of input state:
+    if (i2c_read_burst(i2c_sx1509_btn_addr, REG_DATA_B, buf, 2) != 0) return;
+    fsw_reads++;
+
     // NOTE: we invert (~) button state because they are active low (0) and default high (1):
-    return ~(u16)( ((u16)buf[1] << 8) | (u16)buf[0] );
+    state = ~(u16)( ((u16)buf[0] << 8) | (u16)buf[1] );
+
+    changed = state ^ fsw_state;
+    for (m = 1; changed != 0; m <<= 1) {
+        if (changed & m) {
+            fsw_event_put(m, (state & m) != 0, ts);
+            changed &= ~m;
+        }
+    }
+    fsw_state = state;
 }
 
+// Read the current state stamped with the current time:
+static void fsw_poll_state(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    fsw_read_state(&now);
+}
+
+// Poll 16 foot-switch states:
+u16 fsw_poll(void) {
+    struct gpioevent_data irq;
+    bool pending = false;
+    struct timespec ts;
+
+    // Each controller tick starts with a poll:
+    i2c_tick_end();
+
+    // Without an interrupt line every poll costs an I2C read:
+    if (fsw_irq_fd < 0) {
+        fsw_poll_state();
+        return fsw_state;
+    }
+
+    // Otherwise only touch the bus when NINT fell; stamp edges with the kernel's interrupt time:
+    while (read(fsw_irq_fd, &irq, sizeof(irq)) == sizeof(irq)) {
+        if (!pending) {
+            // Line event timestamps are CLOCK_MONOTONIC (Linux 5.7+):
+            ts.tv_sec = (time_t) (irq.timestamp / 1000000000ULL);
+            ts.tv_nsec = (long) (irq.timestamp % 1000000000ULL);
+        }
+        pending = true;
+        fsw_irq_count++;
+    }
+
+    if (pending) {
+        fsw_read_state(&ts);
+    }
+
+    return fsw_state;
+}
+
+// LED word last written successfully; led_set skips the bus when it has not changed:
+u16 led_last = 0;
+bool led_last_valid = false;
+unsigned long led_writes_skipped = 0;
+
 // Set 16 LED states:
 void led_set(u16 leds) {
-    u8 buf[2];
-    buf[0] = leds & (u8)0xFF;
-    buf[1] = (u8)(leds >> (u8)8) & (u8)0xFF;
-    // Read both data registers to get entire 16 bits of input state:
-    if (i2c_write(i2c_sx1509_led_addr, REG_DATA_A, buf[0]) != 0) return;
-    if (i2c_write(i2c_sx1509_led_addr, REG_DATA_B, buf[1]) != 0) return;
-    return;
+    if (led_last_valid && (leds == led_last)) {
+        led_writes_skipped++;
+        return;
+    }
+
+    // Write RegDataB and RegDataA in one transaction:
+    if (sx1509_write16(i2c_sx1509_led_addr, REG_DATA_B, leds) != 0) {
+        led_last_valid = false;
+        return;
+    }
+    led_last = leds;
+    led_last_valid = true;
 }
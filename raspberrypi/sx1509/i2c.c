@@ -29,6 +29,70 @@ void i2c_close() {
     close(i2c_fd);
 }
 
+// Largest burst write (register address + data):
+#define I2C_BURST_MAX 16
+
+// Write `count` consecutive registers starting at `reg` in one transaction (SX1509 auto-increments):
+int i2c_write_burst(u8 slave_addr, u8 reg, const u8 *data, u16 count) {
+    u8 outbuf[I2C_BURST_MAX + 1];
+
+    struct i2c_msg msgs[1];
+    struct i2c_rdwr_ioctl_data msgset[1];
+
+    if (count > I2C_BURST_MAX) {
+        fprintf(stderr, "i2c_write_burst: %u bytes is more than %u\n", count, I2C_BURST_MAX);
+        return -1;
+    }
+
+    outbuf[0] = reg;
+    memcpy(&outbuf[1], data, count);
+
+    msgs[0].addr = slave_addr;
+    msgs[0].flags = 0;
+    msgs[0].len = count + 1;
+    msgs[0].buf = outbuf;
+
+    msgset[0].msgs = msgs;
+    msgset[0].nmsgs = 1;
+
+    if (ioctl(i2c_fd, I2C_RDWR, &msgset) < 0) {
+        perror("ioctl(I2C_RDWR)");
+        return -1;
+    }
+
+    return 0;
+}
+
+// Read `count` consecutive registers starting at `reg` in one combined write-read transaction:
+int i2c_read_burst(u8 slave_addr, u8 reg, u8 *result, u16 count) {
+    u8 outbuf[1];
+    struct i2c_msg msgs[2];
+    struct i2c_rdwr_ioctl_data msgset[1];
+
+    msgs[0].addr = slave_addr;
+    msgs[0].flags = 0;
+    msgs[0].len = 1;
+    msgs[0].buf = outbuf;
+
+    msgs[1].addr = slave_addr;
+    msgs[1].flags = I2C_M_RD | I2C_M_NOSTART;
+    msgs[1].len = count;
+    msgs[1].buf = result;
+
+    msgset[0].msgs = msgs;
+    msgset[0].nmsgs = 2;
+
+    outbuf[0] = reg;
+
+    memset(result, 0, count);
+    if (ioctl(i2c_fd, I2C_RDWR, &msgset) < 0) {
+        perror("ioctl(I2C_RDWR)");
+        return -1;
+    }
+
+    return 0;
+}
+
 int i2c_write(u8 slave_addr, u8 reg, u8 data) {
     int retval;
     u8 outbuf[2];
@@ -5,3 +5,7 @@ void i2c_close();
 
 int i2c_write(u8 slave_addr, u8 reg, u8 data);
 int i2c_read(u8 slave_addr, u8 reg, u8 *result);
+
+// Multi-register transfers starting at `reg` in a single I2C_RDWR ioctl:
+int i2c_write_burst(u8 slave_addr, u8 reg, const u8 *data, u16 count);
+int i2c_read_burst(u8 slave_addr, u8 reg, u8 *result, u16 count);
@@ -7,13 +7,11 @@ typedef u8 byte;
 
 u16 sx1509_read_data(u8 slave_addr) {
     u8 buf[2];
-    if (i2c_read(slave_addr, REG_DATA_A, &buf[0]) != 0) {
+    // RegDataB then RegDataA in one transaction:
+    if (i2c_read_burst(slave_addr, REG_DATA_B, buf, 2) != 0) {
         return 0;
     }
-    if (i2c_read(slave_addr, REG_DATA_B, &buf[1]) != 0) {
-        return 0;
-    }
-    return ~(u16)( ((u16)buf[1] << 8) | (u16)buf[0] );
+    return ~(u16)( ((u16)buf[0] << 8) | (u16)buf[1] );
 }
 
 #define BYTE_TO_BINARY_PATTERN "%c%c%c%c%c%c%c%c"
@@ -9,7 +9,6 @@
 #include <termios.h>
 #include <ctype.h>
 #include <stdbool.h>
-#include <bits/signum.h>
 #include <signal.h>
 
 #include "types.h"
@@ -99,12 +98,21 @@ void ts_shutdown(void) {
     close(ts_fd);
 }
 
+int ts_poll_fd(void) {
+    return ts_fd;
+}
+
 bool ts_poll(void) {
     bool changed = false;
     struct input_event ev;
     size_t size = sizeof(struct input_event);
 
     while (read(ts_fd, &ev, size) == size) {
+        // Apply touch edges once per complete report, after its position updates:
+        if ((ev.type == EV_SYN) && (ev.code == SYN_REPORT)) {
+            ux_ts_sync();
+            continue;
+        }
         if (ev.type != EV_ABS) continue;
 
         switch (ev.code) {
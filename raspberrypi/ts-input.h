@@ -6,4 +6,7 @@ int ts_init(void);
 
 void ts_shutdown(void);
 
-bool ts_poll(void);
\ No newline at end of file
+bool ts_poll(void);
+
+// File descriptor that becomes readable on touchscreen input, or -1 if not opened:
+int ts_poll_fd(void);
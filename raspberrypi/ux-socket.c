@@ -0,0 +1,373 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "types.h"
+#include "hardware.h"
+#include "report-pub.h"
+#include "report-delta.h"
+#include "ux-socket.h"
+
+const char *ux_socket_path = "eminor3.sock";
+
+unsigned long ux_socket_dropped = 0;
+
+#if defined(__linux) && defined(HWFEAT_REPORT)
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define UX_SOCKET_MAX_CLIENTS 8
+
+// Per-client output queue; a few dozen frames:
+#define UX_SOCKET_OUT_SIZE 4096
+
+// Longest command line accepted:
+#define UX_SOCKET_IN_SIZE 128
+
+#define UX_SOCKET_HEADER_SIZE 8
+
+struct ux_socket_client {
+    int fd;
+
+    u8 out[UX_SOCKET_OUT_SIZE];
+    int out_len;
+    // EPOLLOUT is registered while output is pending:
+    bool out_waiting;
+
+    char in[UX_SOCKET_IN_SIZE];
+    int in_len;
+};
+
+static int ux_socket_epfd = -1;
+static int ux_socket_listen_fd = -1;
+static struct ux_socket_client ux_socket_clients[UX_SOCKET_MAX_CLIENTS];
+
+// Last report sent to clients and the delta encoder shared by all of them:
+static unsigned long ux_socket_seq = 0;
+static struct report ux_socket_report;
+static struct report_delta_encoder ux_socket_encoder;
+
+static u8 *put_u8(u8 *p, int v) {
+    *p++ = (u8) v;
+    return p;
+}
+
+static u8 *put_u16(u8 *p, unsigned long v) {
+    *p++ = (u8) (v & 0xFF);
+    *p++ = (u8) ((v >> 8) & 0xFF);
+    return p;
+}
+
+static u8 *put_u32(u8 *p, unsigned long v) {
+    p = put_u16(p, v & 0xFFFF);
+    return put_u16(p, (v >> 16) & 0xFFFF);
+}
+
+// Fill in the frame header for a `len` byte update; returns the frame length:
+static int ux_socket_frame(u8 *frame, int len, unsigned long seq) {
+    u8 *p = frame;
+
+    p = put_u8(p, 'R');
+    p = put_u8(p, 2);
+    p = put_u16(p, (unsigned long) len);
+    put_u32(p, seq);
+
+    return UX_SOCKET_HEADER_SIZE + len;
+}
+
+static int ux_socket_watch(int fd, unsigned int events, int op) {
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.fd = fd;
+    if (epoll_ctl(ux_socket_epfd, op, fd, &ev) < 0) {
+        perror("epoll_ctl in ux_socket_watch");
+        return -1;
+    }
+
+    return 0;
+}
+
+static void ux_socket_close(struct ux_socket_client *c) {
+    epoll_ctl(ux_socket_epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    c->fd = -1;
+    c->out_len = 0;
+    c->out_waiting = false;
+    c->in_len = 0;
+}
+
+// Write as much queued output as the socket takes:
+static void ux_socket_flush(struct ux_socket_client *c) {
+    while (c->out_len > 0) {
+        ssize_t n = send(c->fd, c->out, (size_t) c->out_len, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) break;
+            ux_socket_close(c);
+            return;
+        }
+        memmove(c->out, c->out + n, (size_t) (c->out_len - n));
+        c->out_len -= (int) n;
+    }
+
+    // Only ask for EPOLLOUT while output is pending:
+    if ((c->out_len > 0) != c->out_waiting) {
+        c->out_waiting = (c->out_len > 0);
+        ux_socket_watch(c->fd, EPOLLIN | (c->out_waiting ? EPOLLOUT : 0), EPOLL_CTL_MOD);
+    }
+}
+
+// Queue `len` bytes for a client, disconnecting it if it has fallen too far behind:
+static void ux_socket_queue(struct ux_socket_client *c, const u8 *data, int len) {
+    if (c->out_len + len > UX_SOCKET_OUT_SIZE) {
+        fprintf(stderr, "ux-socket: client %d is not keeping up; dropping it\n", c->fd);
+        ux_socket_dropped++;
+        ux_socket_close(c);
+        return;
+    }
+
+    memcpy(c->out + c->out_len, data, (size_t) len);
+    c->out_len += len;
+    ux_socket_flush(c);
+}
+
+static void ux_socket_command(const char *line) {
+    int a, v;
+
+    if ((sscanf(line, "activate_song %d", &v) == 1) && (get_set_list_program(v) >= 0)) {
+        activate_song(v);
+    } else if ((sscanf(line, "activate_program %d", &v) == 1) && (v >= 0) && (v <= 127)) {
+        activate_program(v);
+    } else if ((sscanf(line, "gain_set %d %d", &a, &v) == 2) && (a >= 0) && (a < 2) && (v >= 0) && (v <= 127)) {
+        gain_set(a, (u8) v);
+    } else if ((sscanf(line, "volume_set %d %d", &a, &v) == 2) && (a >= 0) && (a < 2) && (v >= 0) && (v <= 127)) {
+        volume_set(a, (u8) v);
+    } else if (strcmp(line, "next_scene") == 0) {
+        next_scene();
+    } else if (strcmp(line, "prev_scene") == 0) {
+        prev_scene();
+    } else if (line[0] != 0) {
+        fprintf(stderr, "ux-socket: unknown or out of range command '%s'\n", line);
+    }
+}
+
+// Read and run complete command lines:
+static void ux_socket_read(struct ux_socket_client *c) {
+    while (1) {
+        ssize_t n = recv(c->fd, c->in + c->in_len, (size_t) (UX_SOCKET_IN_SIZE - 1 - c->in_len), MSG_DONTWAIT);
+        if (n == 0) {
+            ux_socket_close(c);
+            return;
+        }
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+                ux_socket_close(c);
+            }
+            return;
+        }
+        c->in_len += (int) n;
+
+        char *start = c->in;
+        char *nl;
+        while ((nl = memchr(start, '\n', (size_t) (c->in + c->in_len - start))) != NULL) {
+            *nl = 0;
+            if ((nl > start) && (nl[-1] == '\r')) nl[-1] = 0;
+            ux_socket_command(start);
+            start = nl + 1;
+        }
+        c->in_len -= (int) (start - c->in);
+        memmove(c->in, start, (size_t) c->in_len);
+
+        // Discard a line too long to ever complete:
+        if (c->in_len >= UX_SOCKET_IN_SIZE - 1) {
+            c->in_len = 0;
+        }
+    }
+}
+
+static void ux_socket_accept(void) {
+    int fd, i;
+
+    while ((fd = accept(ux_socket_listen_fd, NULL, NULL)) >= 0) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+        for (i = 0; i < UX_SOCKET_MAX_CLIENTS; i++) {
+            if (ux_socket_clients[i].fd < 0) break;
+        }
+        if (i == UX_SOCKET_MAX_CLIENTS) {
+            fprintf(stderr, "ux-socket: too many clients\n");
+            close(fd);
+            continue;
+        }
+
+        struct ux_socket_client *c = &ux_socket_clients[i];
+        c->fd = fd;
+        c->out_len = 0;
+        c->out_waiting = false;
+        c->in_len = 0;
+        if (ux_socket_watch(fd, EPOLLIN, EPOLL_CTL_ADD) < 0) {
+            close(fd);
+            c->fd = -1;
+            continue;
+        }
+
+        // Bring the new subscriber up to date with a keyframe; deltas follow from the shared encoder:
+        if (ux_socket_seq > 0) {
+            u8 frame[UX_SOCKET_HEADER_SIZE + REPORT_DELTA_MAX];
+            int len = report_delta_keyframe(&ux_socket_report, frame + UX_SOCKET_HEADER_SIZE);
+            ux_socket_queue(c, frame, ux_socket_frame(frame, len, ux_socket_seq));
+        }
+    }
+}
+
+static void ux_socket_shutdown(void) {
+    int i;
+
+    for (i = 0; i < UX_SOCKET_MAX_CLIENTS; i++) {
+        if (ux_socket_clients[i].fd >= 0) {
+            ux_socket_close(&ux_socket_clients[i]);
+        }
+    }
+    if (ux_socket_listen_fd >= 0) {
+        close(ux_socket_listen_fd);
+        unlink(ux_socket_path);
+    }
+}
+
+int ux_socket_init(void) {
+    struct sockaddr_un addr;
+    int i;
+
+    for (i = 0; i < UX_SOCKET_MAX_CLIENTS; i++) {
+        ux_socket_clients[i].fd = -1;
+    }
+    report_delta_encoder_init(&ux_socket_encoder);
+
+    if ((ux_socket_epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        perror("epoll_create1 in ux_socket_init");
+        return 0;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, ux_socket_path, sizeof(addr.sun_path) - 1);
+
+    if ((ux_socket_listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0) {
+        perror("socket in ux_socket_init");
+        goto disable;
+    }
+
+    // Replace a socket left behind by an earlier run:
+    unlink(ux_socket_path);
+    if (bind(ux_socket_listen_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        fprintf(stderr, "ux-socket: bind('%s'): %s\n", ux_socket_path, strerror(errno));
+        goto disable;
+    }
+    if (listen(ux_socket_listen_fd, UX_SOCKET_MAX_CLIENTS) < 0) {
+        perror("listen in ux_socket_init");
+        goto disable;
+    }
+    if (ux_socket_watch(ux_socket_listen_fd, EPOLLIN, EPOLL_CTL_ADD) < 0) {
+        goto disable;
+    }
+
+    atexit(ux_socket_shutdown);
+
+    return 0;
+
+disable:
+    if (ux_socket_listen_fd >= 0) {
+        close(ux_socket_listen_fd);
+        ux_socket_listen_fd = -1;
+    }
+    close(ux_socket_epfd);
+    ux_socket_epfd = -1;
+    return 0;
+}
+
+int ux_socket_poll_fd(void) {
+    return ux_socket_epfd;
+}
+
+void ux_socket_poll(void) {
+    struct epoll_event events[UX_SOCKET_MAX_CLIENTS + 1];
+    int n, i, k;
+
+    if (ux_socket_epfd < 0) return;
+
+    n = epoll_wait(ux_socket_epfd, events, UX_SOCKET_MAX_CLIENTS + 1, 0);
+    for (i = 0; i < n; i++) {
+        int fd = events[i].data.fd;
+
+        if (fd == ux_socket_listen_fd) {
+            ux_socket_accept();
+            continue;
+        }
+
+        for (k = 0; k < UX_SOCKET_MAX_CLIENTS; k++) {
+            struct ux_socket_client *c = &ux_socket_clients[k];
+            if (c->fd != fd) continue;
+
+            if (events[i].events & (EPOLLHUP | EPOLLERR)) {
+                ux_socket_close(c);
+                break;
+            }
+            if (events[i].events & EPOLLIN) {
+                ux_socket_read(c);
+            }
+            if ((c->fd >= 0) && (events[i].events & EPOLLOUT)) {
+                ux_socket_flush(c);
+            }
+            break;
+        }
+    }
+}
+
+void ux_socket_publish(void) {
+    u8 frame[UX_SOCKET_HEADER_SIZE + REPORT_DELTA_MAX];
+    int i, len;
+
+    if (ux_socket_epfd < 0) return;
+    if (report_seq() == ux_socket_seq) return;
+
+    ux_socket_seq = report_read(&ux_socket_report);
+
+    // Nothing to send if the new report matches the last one:
+    len = report_delta_encode(&ux_socket_encoder, &ux_socket_report, frame + UX_SOCKET_HEADER_SIZE);
+    if (len == 0) return;
+    len = ux_socket_frame(frame, len, ux_socket_seq);
+
+    for (i = 0; i < UX_SOCKET_MAX_CLIENTS; i++) {
+        if (ux_socket_clients[i].fd >= 0) {
+            ux_socket_queue(&ux_socket_clients[i], frame, len);
+        }
+    }
+}
+
+#else
+
+int ux_socket_init(void) {
+    return 0;
+}
+
+int ux_socket_poll_fd(void) {
+    return -1;
+}
+
+void ux_socket_poll(void) {
+}
+
+void ux_socket_publish(void) {
+}
+
+#endif
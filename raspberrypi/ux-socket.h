@@ -0,0 +1,44 @@
+#pragma once
+
+/*
+    Local status/control server on a Unix domain stream socket.
+
+    Every client is a subscriber: on connect it receives a keyframe of the latest report, then one
+    binary frame per published report that changed something (all integers little endian):
+
+        u8  'R'         frame type
+        u8  2           frame version
+        u16 length      payload bytes that follow the 8-byte header
+        u32 seq         report sequence number (see report-pub.h)
+        payload         report update, see report-delta.h; decode with report_delta_decode()
+
+    Clients may send newline-terminated text commands:
+
+        activate_song <setlist index>
+        activate_program <program index>
+        gain_set <amp> <0..127>
+        volume_set <amp> <0..127>
+        next_scene
+        prev_scene
+
+    All sockets are non-blocking. Output is queued per client; a client whose queue cannot take the
+    next frame is disconnected so it never holds up the controller.
+*/
+
+// Path of the listening socket:
+extern const char *ux_socket_path;
+
+// Clients disconnected because their output queue overflowed:
+extern unsigned long ux_socket_dropped;
+
+// Start listening; a failure is reported and leaves the server disabled:
+int ux_socket_init(void);
+
+// File descriptor that becomes readable when any socket needs service, or -1 if disabled:
+int ux_socket_poll_fd(void);
+
+// Accept clients, run their commands and write queued output; never blocks:
+void ux_socket_poll(void);
+
+// Queue the latest report to every client if one was published since the last call:
+void ux_socket_publish(void);
@@ -9,10 +9,18 @@
 #include <ctype.h>
 #include <stdbool.h>
 #include <signal.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <time.h>
+
+#ifdef __linux
+#include <sys/timerfd.h>
+#endif
 
 #include "types.h"
 #include "hardware.h"
 #include "util.h"
+#include "report-pub.h"
 
 #include "ux.h"
 #include "ts-input.h"
@@ -36,6 +44,10 @@ struct winsize tty_win;
 
 struct termios saved_attributes;
 
+static void ux_grid_init(void);
+
+extern unsigned long ux_frames, ux_frame_bytes_total, ux_frame_bytes_max;
+
 // Touchscreen input:
 int ux_ts_x_min;
 int ux_ts_x_max;
@@ -49,9 +61,22 @@ int ts_row;
 
 bool ux_redraw = true;
 
+// Frame rate cap:
+int ux_fps = UX_FPS;
+unsigned long ux_frames_missed = 0;
+
+// Frame timer and when the next frame may be drawn (CLOCK_MONOTONIC ns):
+static int ux_tfd = -1;
+static bool ux_tfd_armed = false;
+static uint64_t ux_frame_next_ns = 0;
+static bool ux_frame_deferred = false;
+
 #ifdef HWFEAT_REPORT
+// Snapshot of the published report each frame draws from, and its sequence number:
 struct report ux_report;
+static unsigned long ux_report_drawn_seq = 0;
 #endif
+unsigned long ux_reports_stale = 0;
 
 // Resets tty0 to initial state on exit:
 void reset_input_mode(void) {
@@ -97,12 +122,23 @@ int tty_init(void) {
 
     // Clear screen:
     write(tty_fd, ANSI_RIS, 2);
+    ux_grid_init();
 
     ux_ts_update_extents(0, tty_win.ws_col, 0, tty_win.ws_row);
 
     return 0;
 }
 
+// Render to `fd` as a `rows` x `cols` terminal, leaving tty settings and input alone:
+void ux_init_headless(int fd, int rows, int cols) {
+    tty_fd = fd;
+    tty_win.ws_row = (unsigned short) rows;
+    tty_win.ws_col = (unsigned short) cols;
+    ux_grid_init();
+
+    ux_ts_update_extents(0, tty_win.ws_col, 0, tty_win.ws_row);
+}
+
 bool mouse_poll();
 
 int max(int a, int b);
@@ -130,6 +166,17 @@ void ux_ts_update_touching(bool touching) {
 
 // Shutdown UX, close files, and restore sane tty:
 void ux_shutdown() {
+    if (ux_frames > 0) {
+        fprintf(stderr, "ux: %lu frames, %lu bytes/frame average, %lu max\n",
+                ux_frames, ux_frame_bytes_total / ux_frames, ux_frame_bytes_max);
+        fprintf(stderr, "ux: %lu frames missed, %lu stale reports\n", ux_frames_missed, ux_reports_stale);
+    }
+
+    if (ux_tfd >= 0) {
+        close(ux_tfd);
+        ux_tfd = -1;
+    }
+
     // disable xterm mouse reporting:
     write(STDOUT_FILENO, ANSI_CSI "?1000l", STRLEN(ANSI_CSI
                                                            "?1000l"));
@@ -168,6 +215,14 @@ int ux_init(void) {
     }
 #endif
 
+#ifdef __linux
+    // One-shot timer for frames deferred by the frame rate cap:
+    if ((ux_tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK)) < 0) {
+        perror("timerfd_create in ux_init");
+        return 13;
+    }
+#endif
+
     // set stdin to non-blocking so we can read mouse events:
     fcntl(0, F_SETFL, fcntl(STDIN_FILENO, F_GETFL) | O_NONBLOCK);
 
@@ -209,9 +264,10 @@ bool mouse_poll() {
         //fprintf(stderr, "MOUSE: b=%d x=%d y=%d\n", (int) b, (int) x, (int) y);
 
         // generate input_events for touchscreen compatibility:
-        ux_ts_update_touching((b & 3) != 3); // pressed = 1 vs. released = -1
         ux_ts_update_col((x - 1) * (ux_ts_x_max - ux_ts_x_min) / (tty_win.ws_col) + ux_ts_x_min);
         ux_ts_update_row((y - 1) * (ux_ts_y_max - ux_ts_y_min) / (tty_win.ws_row) + ux_ts_y_min);
+        ux_ts_update_touching((b & 3) != 3); // pressed = 1 vs. released = -1
+        ux_ts_sync();
         changed = true;
     }
 
@@ -237,17 +293,82 @@ bool ux_poll(void) {
     return changed;
 }
 
+int ux_poll_fds(int *fds, int max) {
+    int n = 0;
+
+    // xterm mouse input arrives on stdin:
+    if (n < max) {
+        fds[n++] = STDIN_FILENO;
+    }
+
+#ifdef HWFEAT_TOUCHSCREEN
+    if ((n < max) && (ts_poll_fd() >= 0)) {
+        fds[n++] = ts_poll_fd();
+    }
+#endif
+
+    return n;
+}
+
 void ux_notify_redraw(void) {
     ux_redraw = true;
 }
 
-#ifdef HWFEAT_REPORT
-// Hand back the global variable location to write reports to:
-struct report *report_target(void) {
-    return &ux_report;
+int ux_timer_fd(void) {
+    return ux_tfd;
 }
+
+static uint64_t ux_now_ns(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000ULL + (uint64_t) now.tv_nsec;
+}
+
+// Returns true if a frame may be drawn now; otherwise arms the frame timer for when it may:
+static bool ux_frame_ready(void) {
+    uint64_t period = 1000000000ULL / (uint64_t) (ux_fps > 0 ? ux_fps : UX_FPS);
+    uint64_t now = ux_now_ns();
+
+    if (now < ux_frame_next_ns) {
+        ux_frame_deferred = true;
+#ifdef __linux
+        if ((ux_tfd >= 0) && !ux_tfd_armed) {
+            struct itimerspec its;
+
+            memset(&its, 0, sizeof(its));
+            its.it_value.tv_sec = (time_t) (ux_frame_next_ns / 1000000000ULL);
+            its.it_value.tv_nsec = (long) (ux_frame_next_ns % 1000000000ULL);
+            if (timerfd_settime(ux_tfd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+                perror("timerfd_settime in ux_frame_ready");
+            } else {
+                ux_tfd_armed = true;
+            }
+        }
+#endif
+        return false;
+    }
+
+#ifdef __linux
+    if (ux_tfd_armed) {
+        uint64_t expirations;
+
+        // Consume the expiration so the timer stops waking the main loop:
+        read(ux_tfd, &expirations, sizeof(expirations));
+        ux_tfd_armed = false;
+    }
 #endif
 
+    // A deferred frame drawn a whole period late missed its slot:
+    if (ux_frame_deferred && (now - ux_frame_next_ns >= period)) {
+        ux_frames_missed += (unsigned long) ((now - ux_frame_next_ns) / period);
+    }
+    ux_frame_deferred = false;
+    ux_frame_next_ns = now + period;
+
+    return true;
+}
+
 // When a new report is ready, redraw the UX:
 void report_notify(void) {
     ux_notify_redraw();
@@ -275,6 +396,186 @@ int ansi_erase_cols(char *buf, int cols) {
     return sprintf(buf, ANSI_CSI "%dX", cols);
 }
 
+// --------------- Double-buffered cell grid:
+
+// ux_draw renders each frame into the back grid; ux_grid_flush diffs it against the front grid (what
+// the terminal shows) and writes only the changed runs of cells.
+
+#define UX_GRID_ROWS 48
+#define UX_GRID_COLS 128
+
+// Unchanged cells shorter than this between two changed runs are rewritten rather than skipped
+// with a cursor move, which costs more bytes:
+#define UX_GRID_RUN_GAP 6
+
+#define UX_ATTR_NORMAL  0
+#define UX_ATTR_REVERSE 1
+
+struct ux_cell {
+    // UTF-8 encoded glyph:
+    char ch[4];
+    u8 len;
+    u8 attr;
+};
+
+static struct ux_cell ux_front[UX_GRID_ROWS][UX_GRID_COLS];
+static struct ux_cell ux_back[UX_GRID_ROWS][UX_GRID_COLS];
+static int ux_grid_rows, ux_grid_cols;
+
+// Drawing position and attribute in the back grid:
+static int ux_cur_row, ux_cur_col;
+static u8 ux_cur_attr;
+
+// Bytes written to the tty per frame:
+unsigned long ux_frame_bytes = 0;
+unsigned long ux_frame_bytes_max = 0;
+unsigned long ux_frame_bytes_total = 0;
+unsigned long ux_frames = 0;
+
+static void ux_grid_clear(struct ux_cell grid[UX_GRID_ROWS][UX_GRID_COLS]) {
+    int r, c;
+
+    for (r = 0; r < UX_GRID_ROWS; r++) {
+        for (c = 0; c < UX_GRID_COLS; c++) {
+            grid[r][c].ch[0] = ' ';
+            grid[r][c].len = 1;
+            grid[r][c].attr = UX_ATTR_NORMAL;
+        }
+    }
+}
+
+// Size the grids to the tty; the screen was just cleared so the front grid is blank:
+static void ux_grid_init(void) {
+    ux_grid_rows = min(tty_win.ws_row, UX_GRID_ROWS);
+    ux_grid_cols = min(tty_win.ws_col, UX_GRID_COLS);
+    ux_grid_clear(ux_front);
+}
+
+// Start a frame with a blank back grid:
+static void ux_grid_begin(void) {
+    ux_grid_clear(ux_back);
+    ux_cur_row = 0;
+    ux_cur_col = 0;
+    ux_cur_attr = UX_ATTR_NORMAL;
+}
+
+static void ux_move(int row, int col) {
+    ux_cur_row = row;
+    ux_cur_col = col;
+}
+
+static void ux_attr(u8 attr) {
+    ux_cur_attr = attr;
+}
+
+// Print UTF-8 text into the back grid at the drawing position, clipped to the grid:
+static void ux_printf(const char *fmt, ...) {
+    char text[256];
+    const u8 *p;
+    va_list ap;
+    int len, n;
+
+    va_start(ap, fmt);
+    vsnprintf(text, sizeof(text), fmt, ap);
+    va_end(ap);
+
+    for (p = (const u8 *) text; *p; p += len, ux_cur_col++) {
+        // Length of the UTF-8 sequence from its lead byte, cut short at the first byte that is not a
+        // continuation (including the terminating NUL):
+        n = (*p < 0xC0) ? 1 : (*p >= 0xF0) ? 4 : (*p >= 0xE0) ? 3 : 2;
+        for (len = 1; (len < n) && ((p[len] & 0xC0) == 0x80); len++);
+
+        if ((ux_cur_row < 0) || (ux_cur_row >= ux_grid_rows) || (ux_cur_col < 0) || (ux_cur_col >= ux_grid_cols)) {
+            continue;
+        }
+
+        struct ux_cell *cell = &ux_back[ux_cur_row][ux_cur_col];
+        if ((len < n) || ((*p >= 0x80) && (*p < 0xC0)) || (*p >= 0xF8)) {
+            // Malformed sequence; show a placeholder instead of sending it to the terminal:
+            cell->ch[0] = '?';
+            cell->len = 1;
+        } else {
+            memcpy(cell->ch, p, (size_t) len);
+            cell->len = (u8) len;
+        }
+        cell->attr = ux_cur_attr;
+    }
+}
+
+static bool ux_cell_equal(const struct ux_cell *a, const struct ux_cell *b) {
+    return (a->len == b->len) && (a->attr == b->attr) && (memcmp(a->ch, b->ch, a->len) == 0);
+}
+
+// Write the cells that differ between back and front grids, then park the cursor at (row, col):
+static void ux_grid_flush(int cursor_row, int cursor_col) {
+    static char out[UX_GRID_ROWS * UX_GRID_COLS * 8];
+    char *buf = out;
+    // Terminal cursor position and attribute as far as we know:
+    static int tty_row = -1, tty_col = -1;
+    static u8 tty_attr = UX_ATTR_NORMAL;
+    int r, c, end, next;
+
+    for (r = 0; r < ux_grid_rows; r++) {
+        c = 0;
+        while (c < ux_grid_cols) {
+            // Find the next changed cell:
+            while ((c < ux_grid_cols) && ux_cell_equal(&ux_back[r][c], &ux_front[r][c])) c++;
+            if (c >= ux_grid_cols) break;
+
+            // Extend the run across short stretches of unchanged cells:
+            end = c + 1;
+            for (next = end; next < ux_grid_cols && next - end < UX_GRID_RUN_GAP; next++) {
+                if (!ux_cell_equal(&ux_back[r][next], &ux_front[r][next])) {
+                    end = next + 1;
+                }
+            }
+
+            if ((tty_row != r) || (tty_col != c)) {
+                if (tty_row == r) {
+                    buf += ansi_move_cursor_col(buf, c);
+                } else {
+                    buf += ansi_move_cursor(buf, r, c);
+                }
+            }
+
+            for (; c < end; c++) {
+                struct ux_cell *cell = &ux_back[r][c];
+                if (cell->attr != tty_attr) {
+                    buf += sprintf(buf, cell->attr == UX_ATTR_REVERSE ? ANSI_CSI "7m" : ANSI_CSI "0m");
+                    tty_attr = cell->attr;
+                }
+                memcpy(buf, cell->ch, cell->len);
+                buf += cell->len;
+                ux_front[r][c] = *cell;
+            }
+            tty_row = r;
+            tty_col = end;
+        }
+    }
+
+    if (tty_attr != UX_ATTR_NORMAL) {
+        buf += sprintf(buf, ANSI_CSI "0m");
+        tty_attr = UX_ATTR_NORMAL;
+    }
+
+    // Move cursor to last touchscreen row,col:
+    if ((tty_row != cursor_row) || (tty_col != cursor_col)) {
+        buf += ansi_move_cursor(buf, cursor_row, cursor_col);
+        tty_row = cursor_row;
+        tty_col = cursor_col;
+    }
+
+    ux_frame_bytes = (unsigned long) (buf - out);
+    ux_frame_bytes_total += ux_frame_bytes;
+    if (ux_frame_bytes > ux_frame_bytes_max) ux_frame_bytes_max = ux_frame_bytes;
+    ux_frames++;
+
+    if (buf == out) return;
+
+    // Send update to tty in one write call to reduce lag/tear:
+    write(tty_fd, out, buf - out);
+}
+
 bool ux_get_sl_name(int sl_idx, char *name) {
     int pr = get_set_list_program(sl_idx);
     if (pr < 0) return false;
@@ -316,23 +617,20 @@ int min(int a, int b) {
     return a < b ? a : b;
 }
 
-char *ux_hslider_draw(char *buf, int row, int col, int inner_width, int value, int value_max) {
+void ux_hslider_draw(int row, int col, int inner_width, int value, int value_max) {
     // Draw meter:
-    buf += ansi_move_cursor(buf, row, col);
-    buf += sprintf(buf, "[");
+    ux_move(row, col);
+    ux_printf("[");
     int value_width = value / (value_max / inner_width);
-    int value_remainder = value % (value_max / inner_width);
     int c = 0;
     for (c = 0; c < value_width; c++) {
-        //buf += sprintf(buf, "\u2588");
-        buf += sprintf(buf, "\u25A0");
+        //ux_printf("\u2588");
+        ux_printf("\u25A0");
     }
     for (; c < inner_width; c++) {
-        buf += sprintf(buf, " ");
+        ux_printf(" ");
     }
-    buf += sprintf(buf, "]");
-
-    return buf;
+    ux_printf("]");
 }
 
 static bool last_ts_touching = false;
@@ -345,6 +643,9 @@ static struct dd_state dd_song = {
 static bool ts_pressed = false;
 static bool ts_released = false;
 
+// Touch state seen by the layout's hit tests: ts_touching while applying input, false while only rendering:
+static bool ts_active = false;
+
 void do_callback(void *state) {
     void (*callback)(void) = state;
     callback();
@@ -371,7 +672,7 @@ void component_touching_action(int component, int row, int col_min, int width, v
             touched_component = component;
         }
         if (touched_component == component) {
-            if (ts_touching) {
+            if (ts_active) {
                 action(state);
             } else if (ts_released) {
                 touched_component = -1;
@@ -392,20 +693,10 @@ void gain_slider_touching(void *state) {
     gain_set(a, (u8) new_gain);
 }
 
-// Draw UX screen:
-void ux_draw(void) {
-    // Only redraw if necessary:
-    if (!ux_redraw) return;
-    ux_redraw = false;
-
 #ifdef HWFEAT_REPORT
-    // Prefer report feature for rendering a UX:
-    char out[2500] = "";
-    char *buf = out;
-
-    ts_pressed = !last_ts_touching && ts_touching;
-    ts_released = last_ts_touching && !ts_touching;
-
+// Lay out the screen into the back grid from ux_report, running the touch actions of components
+// under ts_row,ts_col for the current ts_pressed/ts_released/ts_active:
+static void ux_layout(void) {
     int component = 0;
 
     // Show program name at top as a drop-down menu:
@@ -455,7 +746,7 @@ void ux_draw(void) {
                     dd_song.is_dragging = false;
                     dd_song.drag_row = -1;
                 }
-            } else if (ts_touching) {
+            } else if (ts_active) {
                 if (dd_song.drag_row != ts_row) {
                     // Start dragging:
                     if (!dd_song.is_dragging) {
@@ -469,20 +760,14 @@ void ux_draw(void) {
         }
 
         if (closing) {
-            // Close the drop-down and erase dirty bit:
+            // Close the drop-down; the grid diff erases it:
             dd_song.is_open = false;
-            for (int i = 0; i < dd_song.rows; i++) {
-                buf += ansi_move_cursor(buf, 1 + i, 6);
-                // Erase 20+4 characters:
-                buf += ansi_erase_cols(buf, REPORT_PR_NAME_LEN + 4);
-            }
         }
     }
 
     // Render song drop-down control:
-    buf += ansi_move_cursor(buf, 0, 0);
-    buf += sprintf(
-            buf,
+    ux_move(0, 0);
+    ux_printf(
             "Song: [%c%-*s ]",
             ux_report.is_modified ? '*' : ' ',
             REPORT_PR_NAME_LEN,
@@ -490,8 +775,8 @@ void ux_draw(void) {
     );
 
     // Setlist/program toggle button:
-    buf += ansi_move_cursor(buf, 0, 31);
-    buf += sprintf(buf, "(%s)", ux_report.is_setlist_mode ? "SETLIST" : "PROGRAM");
+    ux_move(0, 31);
+    ux_printf("(%s)", ux_report.is_setlist_mode ? "SETLIST" : "PROGRAM");
 
     // Toggle setlist/program mode on first press:
     component_pressed_action(component, 0, 31, 39, toggle_setlist_mode, do_callback);
@@ -499,25 +784,25 @@ void ux_draw(void) {
 
     if (!dd_song.is_open) {
         // Show song/program index:
-        buf += ansi_move_cursor_col(buf, 43);
+        ux_move(0, 43);
         if (ux_report.is_setlist_mode) {
-            buf += sprintf(buf, "%3d/%3d", ux_report.sl_val, ux_report.sl_max);
+            ux_printf("%3d/%3d", ux_report.sl_val, ux_report.sl_max);
         } else {
-            buf += sprintf(buf, "%3d/%3d", ux_report.pr_val, ux_report.pr_max);
+            ux_printf("%3d/%3d", ux_report.pr_val, ux_report.pr_max);
         }
 
         // Show second status line:
-        buf += ansi_move_cursor(buf, 1, 0);
-        buf += sprintf(buf, "Scene: %2d/%2d", ux_report.sc_val, ux_report.sc_max);
-        buf += ansi_move_cursor(buf, 1, 13);
-        buf += sprintf(buf, "(PREV) (NEXT)");
+        ux_move(1, 0);
+        ux_printf("Scene: %2d/%2d", ux_report.sc_val, ux_report.sc_max);
+        ux_move(1, 13);
+        ux_printf("(PREV) (NEXT)");
         component_pressed_action(component, 1, 13, 19, prev_scene, do_callback);
         component++;
         component_pressed_action(component, 1, 21, 26, next_scene, do_callback);
         component++;
 
-        buf += ansi_move_cursor(buf, 1, 49 - 18);
-        buf += sprintf(buf, "%3dbpm", ux_report.tempo);
+        ux_move(1, 49 - 18);
+        ux_printf("%3dbpm", ux_report.tempo);
 
 #define AMP_UX_ROWS 6
 
@@ -527,40 +812,35 @@ void ux_draw(void) {
             struct amp_report amp = ux_report.amp[a];
 
             // Draw horizontal slider box for volume:
-            buf += ansi_move_cursor(buf, row, 0);
-            buf += sprintf(buf, "Volume: %3d", amp.volume);
-            buf = ux_hslider_draw(buf, row, 12, 32, amp.volume + 1, 128);
+            ux_move(row, 0);
+            ux_printf("Volume: %3d", amp.volume);
+            ux_hslider_draw(row, 12, 32, amp.volume + 1, 128);
             component_touching_action(component, row, 12, 32, (void *)a, volume_slider_touching);
             component++;
 
             // Draw horizontal slider box for gain:
             ++row;
-            buf += ansi_move_cursor(buf, row, 0);
-            buf += sprintf(buf, "Gain:   %3d", amp.gain_dirty);
-            buf = ux_hslider_draw(buf, row, 12, 32, amp.gain_dirty + 1, 128);
+            ux_move(row, 0);
+            ux_printf("Gain:   %3d", amp.gain_dirty);
+            ux_hslider_draw(row, 12, 32, amp.gain_dirty + 1, 128);
             component_touching_action(component, row, 12, 32, (void *)a, gain_slider_touching);
             component++;
 
             ++row;
             for (int fx = 0; fx < FX_COUNT; fx++) {
                 if (amp.fx_enabled[fx]) {
-                    buf += sprintf(buf, ANSI_CSI"7m");
+                    ux_attr(UX_ATTR_REVERSE);
                 }
                 const char *fxName = fx_name(amp.fx_midi_cc[fx]);
-                buf += ansi_move_cursor(buf, row, fx * (5+4));
-                buf += sprintf(buf, "[ %.4s ]", fxName);
+                ux_move(row, fx * (5+4));
+                ux_printf("[ %.4s ]", fxName);
                 if (amp.fx_enabled[fx]) {
-                    buf += sprintf(buf, ANSI_CSI"0m");
+                    ux_attr(UX_ATTR_NORMAL);
                 }
                 //component_pressed_action(component, row, fx * (5+4), fx * (5+4) + 7, );
                 component++;
             }
-            ++row;
-            buf += ansi_move_cursor(buf, row, 0);
-            ++row;
-            buf += ansi_move_cursor(buf, row, 0);
-            ++row;
-            buf += ansi_move_cursor(buf, row, 0);
+            row += 3;
         }
     } else {
         // Render drop-down list on top:
@@ -569,28 +849,66 @@ void ux_draw(void) {
             int item_index = i + dd_song.list_offset;
             dd_song.list_item(item_index, name);
 
-            buf += ansi_move_cursor(buf, 1 + i, 6);
+            ux_move(1 + i, 6);
             if (item_index == dd_song.item_index) {
-                buf += sprintf(buf, "\u2503" ANSI_CSI"7m" " %-*s " ANSI_CSI"0m" "\u2503", REPORT_PR_NAME_LEN, name);
+                ux_printf("\u2503");
+                ux_attr(UX_ATTR_REVERSE);
+                ux_printf(" %-*s ", REPORT_PR_NAME_LEN, name);
+                ux_attr(UX_ATTR_NORMAL);
+                ux_printf("\u2503");
             } else {
-                buf += sprintf(buf, "\u2503 %-*s \u2503", REPORT_PR_NAME_LEN, name);
+                ux_printf("\u2503 %-*s \u2503", REPORT_PR_NAME_LEN, name);
             }
         }
     }
+}
+#endif
 
-    // Move cursor to last touchscreen row,col:
-    buf += ansi_move_cursor(buf, ts_row, ts_col);
-
-    //fprintf(stderr, "%lu\n", buf - out);
+// Apply one complete touch or mouse report; called by the input back ends for every report so
+// that taps shorter than a frame period are not lost to the frame rate cap:
+void ux_ts_sync(void) {
+#ifdef HWFEAT_REPORT
+    ts_pressed = !last_ts_touching && ts_touching;
+    ts_released = last_ts_touching && !ts_touching;
+    ts_active = ts_touching;
 
-    // Send update to tty in one write call to reduce lag/tear:
-    write(tty_fd, out, buf - out);
+    // Hit-test against what is on screen; the back grid is redrawn before the next flush:
+    if (ts_pressed || ts_released || ts_active) {
+        ux_layout();
+    }
 
     // Clear touched component after release:
     if (ts_released && (touched_component != -1)) {
         touched_component = -1;
     }
+    ts_pressed = false;
+    ts_released = false;
+    ts_active = false;
+#endif
     last_ts_touching = ts_touching;
+}
+
+// Draw UX screen:
+void ux_draw(void) {
+    // Only redraw if necessary and at most ux_fps times per second:
+    if (!ux_redraw) return;
+    if (!ux_frame_ready()) return;
+    ux_redraw = false;
+
+#ifdef HWFEAT_REPORT
+    // Take a snapshot of the latest report; count those published since the last frame that were never drawn:
+    if (report_seq() != ux_report_drawn_seq) {
+        unsigned long seq = report_read(&ux_report);
+        ux_reports_stale += seq - ux_report_drawn_seq - 1;
+        ux_report_drawn_seq = seq;
+    }
+
+    // Prefer report feature for rendering a UX; touch input was already applied by ux_ts_sync:
+    ux_grid_begin();
+    ux_layout();
+
+    // Write changed cells and move cursor to last touchscreen row,col:
+    ux_grid_flush(ts_row, ts_col);
 #else
 # ifdef FEAT_LCD
     u8 row;
@@ -5,16 +5,41 @@
 // Initialize UX (user experience):
 int ux_init(void);
 
+// Draw to `fd` as a `rows` x `cols` terminal without a tty, e.g. /dev/null for benchmarks:
+void ux_init_headless(int fd, int rows, int cols);
+
 // Mark UX as ready for redraw:
 void ux_notify_redraw(void);
 
-// Draw UX screen:
+// Maximum UX redraw rate in frames per second:
+#ifndef UX_FPS
+#define UX_FPS 30
+#endif
+
+extern int ux_fps;
+
+// Frames drawn more than one frame period past their deadline because the main loop was busy:
+extern unsigned long ux_frames_missed;
+
+// Reports replaced by a newer one before any frame drew them:
+extern unsigned long ux_reports_stale;
+
+// Draw UX screen if a redraw is pending and the frame period has elapsed:
 void ux_draw(void);
 
+// Timer that wakes the main loop when a deferred frame is due (-1 if none):
+int ux_timer_fd(void);
+
 // Poll for UX events:
 bool ux_poll(void);
 
+// Fill `fds` with up to `max` file descriptors that become readable on UX input; returns count:
+int ux_poll_fds(int *fds, int max);
+
 void ux_ts_update_extents(int x_min, int x_max, int y_min, int y_max);
 void ux_ts_update_row(int y);
 void ux_ts_update_col(int x);
 void ux_ts_update_touching(bool touching);
+
+// Apply the touch state set by the ux_ts_update_* calls of one complete input report:
+void ux_ts_sync(void);
@@ -1143,7 +1143,7 @@ void flash_load(u16 addr, u16 count, u8 *data) {
 }
 
 // Stores `count` bytes from `data` into flash memory at address `addr` (0-based where 0 is first available byte of available flash memory):
-void flash_store(u16 addr, u16 count, u8 *data) {
+int flash_store(u16 addr, u16 count, u8 *data) {
     u8 bank = (u8)(addr >> 12);
     addr &= 0x0FFF;
 
@@ -1151,6 +1151,7 @@ void flash_store(u16 addr, u16 count, u8 *data) {
     assert(((addr)& ~63) == (((addr + count - 1)) & ~63));
 
     memcpy((void *)&flash_bank[bank][addr], (void *)data, count);
+    return 0;
 }
 
 // Get a pointer to flash memory at address: